@@ -11,6 +11,9 @@
 #include <math.h>
 #include <CImg.h>
 #include <ImageMagick-7/Magick++.h>
+#include <vector>
+
+#include "../vkWarp/WarpMapFormat.h"
 
 using namespace cimg_library;
 
@@ -21,10 +24,10 @@ public:
     SimpleWarpUV(/* args */);
     ~SimpleWarpUV();
 
-    static void generate();
+    static void generate(uint32_t precision);
 };
 
-void SimpleWarpUV::generate(){
+void SimpleWarpUV::generate(uint32_t precision){
     CImg<u_short> uvMS(WIDTH, HEIGHT, 1, 3);
     CImg<u_short> uvLS(WIDTH, HEIGHT, 1, 3);
     u_int val = 0;
@@ -59,10 +62,38 @@ void SimpleWarpUV::generate(){
 
     uvMS.save("SimpleWarpUVIntensityMS.png");
     uvLS.save("SimpleWarpUVIntensityLS.png");
+
+    // same map as a single binary file with its mip chain, memory-mapped by vkWarp (--warp-map=SimpleWarpUVIntensity.vwm)
+    std::vector<uint16_t> uvi(3 * WIDTH * HEIGHT);
+    for (int i = 0; i < HEIGHT; i++) {
+        for (int j = 0; j < WIDTH; j++) {
+            for (int c = 0; c < 3; c++) {
+                uvi[3 * (i * WIDTH + j) + c] = static_cast<uint16_t>((uvMS(j, i, 0, c) << 8) | uvLS(j, i, 0, c));
+            }
+        }
+    }
+    if (!writeWarpMap("SimpleWarpUVIntensity.vwm", WIDTH, HEIGHT, uvi.data(), precision, true)) {
+        std::cerr << "failed to write SimpleWarpUVIntensity.vwm" << std::endl;
+    }
 }
 
 int main(int argc, char* argv[]){
-    SimpleWarpUV::generate();
+    // precision of the .vwm file: 8, 16 (default), fp16 or fp32
+    uint32_t precision = WARP_MAP_UNORM16;
+    if (argc > 1) {
+        std::string arg = argv[1];
+        if (arg == "8") {
+            precision = WARP_MAP_UNORM8;
+        } else if (arg == "fp16") {
+            precision = WARP_MAP_FLOAT16;
+        } else if (arg == "fp32") {
+            precision = WARP_MAP_FLOAT32;
+        } else if (arg != "16") {
+            std::cerr << "unknown precision " << arg << " (8, 16, fp16 or fp32)" << std::endl;
+            return 1;
+        }
+    }
+    SimpleWarpUV::generate(precision);
 
     return 0;
 }
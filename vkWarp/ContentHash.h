@@ -0,0 +1,122 @@
+// 64-bit content hash (XXH64 of xxHash), shared by vkWarp and the UVTextures generators.
+//
+// Every input bit reaches every bit of the digest, and the result does not depend on the CPU, so it can key files
+// written on one machine and read on another (texture cache entries, .vwm checksums, pipeline cache headers).
+// The input can be fed in chunks of any size, the digest is the same as hashing it in one go.
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+class ContentHash {
+public:
+    explicit ContentHash(uint64_t seed = 0) {
+        acc[0] = seed + PRIME1 + PRIME2;
+        acc[1] = seed + PRIME2;
+        acc[2] = seed;
+        acc[3] = seed - PRIME1;
+        this->seed = seed;
+    }
+
+    void update(const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        total += size;
+        if (buffered > 0) {
+            // completing the stripe left over by the previous update
+            size_t fill = std::min(size, sizeof(buffer) - buffered);
+            memcpy(buffer + buffered, bytes, fill);
+            buffered += fill;
+            bytes += fill;
+            size -= fill;
+            if (buffered < sizeof(buffer)) {
+                return;
+            }
+            consumeStripe(buffer);
+            buffered = 0;
+        }
+        for (; size >= sizeof(buffer); bytes += sizeof(buffer), size -= sizeof(buffer)) {
+            consumeStripe(bytes);
+        }
+        memcpy(buffer, bytes, size);
+        buffered = size;
+    }
+
+    uint64_t digest() const {
+        uint64_t hash;
+        if (total >= sizeof(buffer)) {
+            hash = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+            for (uint64_t lane : acc) {
+                hash = (hash ^ round(0, lane)) * PRIME1 + PRIME4;
+            }
+        } else {
+            hash = seed + PRIME5;
+        }
+        hash += total;
+
+        size_t i = 0;
+        for (; i + 8 <= buffered; i += 8) {
+            hash ^= round(0, read64(buffer + i));
+            hash = rotl(hash, 27) * PRIME1 + PRIME4;
+        }
+        if (i + 4 <= buffered) {
+            uint32_t word;
+            memcpy(&word, buffer + i, sizeof(word));
+            hash ^= word * PRIME1;
+            hash = rotl(hash, 23) * PRIME2 + PRIME3;
+            i += 4;
+        }
+        for (; i < buffered; i++) {
+            hash ^= buffer[i] * PRIME5;
+            hash = rotl(hash, 11) * PRIME1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME2;
+        hash ^= hash >> 29;
+        hash *= PRIME3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+private:
+    static const uint64_t PRIME1 = 0x9e3779b185ebca87ull;
+    static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4full;
+    static const uint64_t PRIME3 = 0x165667b19e3779f9ull;
+    static const uint64_t PRIME4 = 0x85ebca77c2b2ae63ull;
+    static const uint64_t PRIME5 = 0x27d4eb2f165667c5ull;
+
+    static uint64_t rotl(uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+
+    static uint64_t read64(const uint8_t* bytes) {
+        uint64_t word; // little-endian hosts only, like the file formats using the hash
+        memcpy(&word, bytes, sizeof(word));
+        return word;
+    }
+
+    static uint64_t round(uint64_t lane, uint64_t input) {
+        return rotl(lane + input * PRIME2, 31) * PRIME1;
+    }
+
+    void consumeStripe(const uint8_t* stripe) {
+        for (int lane = 0; lane < 4; lane++) {
+            acc[lane] = round(acc[lane], read64(stripe + 8 * lane));
+        }
+    }
+
+    uint64_t acc[4];
+    uint64_t seed;
+    uint64_t total = 0;
+    uint8_t buffer[32];
+    size_t buffered = 0;
+};
+
+inline uint64_t contentHash(const void* data, size_t size, uint64_t seed = 0) {
+    ContentHash hash(seed);
+    hash.update(data, size);
+    return hash.digest();
+}
+
+#endif
@@ -5,12 +5,32 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+// stb_image allocates through these hooks, so that a decode can write its output straight into mapped staging memory
+// (see decodeImageInto)
+static void* stbiMalloc(size_t size);
+static void* stbiRealloc(void* pointer, size_t size);
+static void stbiFree(void* pointer);
+#define STBI_MALLOC(size) stbiMalloc(size)
+#define STBI_REALLOC(pointer, size) stbiRealloc(pointer, size)
+#define STBI_FREE(pointer) stbiFree(pointer)
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
 
 #if __linux__
     #include <X11/Xlib.h>
+    #include <X11/Xutil.h>
     #include <X11/Xmu/WinUtil.h>
+    #include <X11/extensions/XShm.h>
+    #include <sys/ipc.h>
+    #include <sys/shm.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/inotify.h>
+    #include <glob.h>
     #define OS 1
 #elif _WIN32
     #define OS 2
@@ -22,6 +42,13 @@
 
 #include <set>
 #include <array>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <memory>
 #include <chrono>
 #include <time.h>
 #include <algorithm>
@@ -29,19 +56,55 @@
 #include <stdexcept>
 #include <functional>
 //#include <cstdlib>
+#include <cstdio>
 #include <cstring>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
 #include <fstream>
 #include <optional>
+#include <filesystem>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <nmmintrin.h>
+    #include <immintrin.h>
+#endif
 #include <vulkan/vk_sdk_platform.h>
 #include <vulkan/vulkan.hpp>
 
 #include "../include/vkWarpConfig.h"
 
+// SPIR-V generated at build time from shaders/shader.vert and shaders/shader.frag (glslangValidator --vn)
+#include "ContentHash.h"
+#include "WarpMapFormat.h"
+#include "shaders/vert.spv.h"
+#include "shaders/frag.spv.h"
+
 const int WIDTH = 1920;
 const int HEIGHT = 1080;
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+// screen region grabbed in capture mode (HEIGHT x HEIGHT square starting at this offset)
+const int CAPTURE_OFFSET_X = 420;
+const int CAPTURE_OFFSET_Y = 0;
+// number of persistent XImages cycled by the capture backend:
+// writer + published + reader front, plus one per frame in flight that may still be copying from an older slot
+const int CAPTURE_POOL_SIZE = 3 + MAX_FRAMES_IN_FLIGHT;
+// upper bound for the capture thread rate
+const int CAPTURE_MAX_FPS = 60;
+// captures are compared and uploaded in square tiles of this size (in pixels)
+const int CAPTURE_TILE_SIZE = 64;
+// the output is redrawn in square tiles of this size (in pixels) when only part of the capture changed
+const int OUTPUT_TILE_SIZE = 64;
+// shared-memory segments are padded to this size, so that they can be imported as host memory (minImportedHostPointerAlignment)
+const size_t CAPTURE_SHM_ALIGNMENT = 65536;
+// initial size of each per-frame staging ring (grown when a frame streams more than this)
+const VkDeviceSize STAGING_RING_SIZE = 8 << 20;
+// pipeline cache kept between runs (relative to the working directory, like the shaders)
+const char* PIPELINE_CACHE_FILE = "pipeline_cache.bin";
+// a watched warp map is reloaded once no write has touched it for this long (the MS and LS files are written one after the other)
+const int WARP_RELOAD_SETTLE_MS = 250;
+
 const std::vector<const char*> validationLayers = {"VK_LAYER_KHRONOS_validation"};
 const std::vector<const char*> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
@@ -90,6 +153,7 @@ VkResult DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessenge
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily; // transfer-only family (no graphics), if the device exposes one
 
     bool isComplete() {
         return graphicsFamily.has_value()
@@ -97,351 +161,3040 @@ struct QueueFamilyIndices {
     } 
 };
 
-struct SwapChainSupportDetails {
-    VkSurfaceCapabilitiesKHR surfaceCapabilities;
-    std::vector<VkSurfaceFormatKHR> formats;
-    std::vector<VkPresentModeKHR> presentModes;
+// Hashing the rows of a tile (rowBytes per row, stride bytes apart) to detect which tiles of a capture changed:
+// CRC32C with the SSE4.2 instruction when the CPU has it, XXH64 (ContentHash.h) otherwise
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static uint32_t hashTileCrc32(const uint8_t* data, size_t stride, size_t rowBytes, uint32_t rows) {
+    uint64_t crc = 0;
+    for (uint32_t y = 0; y < rows; y++) {
+        const uint8_t* row = data + y * stride;
+        size_t x = 0;
+        for (; x + 8 <= rowBytes; x += 8) {
+            uint64_t word;
+            memcpy(&word, row + x, sizeof(word));
+            crc = _mm_crc32_u64(crc, word);
+        }
+        for (; x < rowBytes; x++) {
+            crc = _mm_crc32_u8(static_cast<uint32_t>(crc), row[x]);
+        }
+    }
+    return static_cast<uint32_t>(crc);
+}
+#endif
+
+static uint32_t hashTileXxh64(const uint8_t* data, size_t stride, size_t rowBytes, uint32_t rows) {
+    ContentHash hash;
+    for (uint32_t y = 0; y < rows; y++) {
+        hash.update(data + y * stride, rowBytes);
+    }
+    uint64_t digest = hash.digest();
+    return static_cast<uint32_t>(digest ^ (digest >> 32));
+}
+
+static uint32_t hashTile(const uint8_t* data, size_t stride, size_t rowBytes, uint32_t rows) {
+    #if defined(__x86_64__) || defined(__i386__)
+        static const bool crc32Supported = __builtin_cpu_supports("sse4.2");
+        if (crc32Supported) {
+            return hashTileCrc32(data, stride, rowBytes, rows);
+        }
+    #endif
+    return hashTileXxh64(data, stride, rowBytes, rows);
+}
+
+#if __linux__
+// XImage reused across frames (shared-memory backed when MIT-SHM is available), so that capturing does not allocate nor copy through the X socket
+struct CaptureSlot {
+    XImage* image = nullptr;
+    XShmSegmentInfo shmInfo = {};
+    size_t shmSize = 0; // padded to CAPTURE_SHM_ALIGNMENT
+    std::vector<uint32_t> tileHashes; // one per CAPTURE_TILE_SIZE tile, row by row (filled by the capture thread)
 };
+#endif
 
-struct Vertex {
-    glm::vec2 pos;
-    glm::vec3 color;
-    glm::vec2 texCoord;
+// Lock-free triple buffer of slot indices: the writer fills its back slot and publishes it as the middle one,
+// the reader swaps one of its free slots with the middle one only when a newer frame has been published.
+// The reader owns CAPTURE_POOL_SIZE - 2 slots, so that slots still read by frames in flight (see hold/release)
+// are never handed back to the writer.
+class TripleBuffer {
+public:
+    // writer side: slot being filled
+    uint32_t backSlot() const { return back; }
+
+    // writer side: returns true if the previously published frame was never picked up (dropped)
+    bool publish() {
+        uint32_t previous = middle.exchange(back | FRESH_BIT, std::memory_order_acq_rel);
+        back = previous & INDEX_MASK;
+        return (previous & FRESH_BIT) != 0;
+    }
 
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription bindingDescr = {};
-        bindingDescr.binding = 0;
-        bindingDescr.stride = sizeof(Vertex);
-        bindingDescr.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    // reader side: slot currently read
+    uint32_t frontSlot() const { return front; }
 
-        return bindingDescr;
+    // reader side: the front slot is read by the GPU until the given frame in flight has completed
+    void hold(size_t frame) { held[frame] = front; }
+    void release(size_t frame) { held[frame] = NO_SLOT; }
+
+    // reader side: returns false if no new frame has been published since last call
+    bool acquire() {
+        if ((middle.load(std::memory_order_acquire) & FRESH_BIT) == 0) {
+            return false;
+        }
+        for (auto& slot : readerSlots) {
+            if (slot != front && std::find(held.begin(), held.end(), slot) == held.end()) {
+                slot = middle.exchange(slot, std::memory_order_acq_rel) & INDEX_MASK;
+                front = slot;
+                return true;
+            }
+        }
+        return false; // cannot happen with CAPTURE_POOL_SIZE slots, every held slot belongs to a different frame
     }
 
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 3> attrDesrc = {};
-        
-        attrDesrc[0].binding = 0;
-        attrDesrc[0].location = 0;
-        attrDesrc[0].format = VK_FORMAT_R32G32_SFLOAT;
-        attrDesrc[0].offset = offsetof(Vertex, pos);
+private:
+    static constexpr uint32_t INDEX_MASK = 0x7;
+    static constexpr uint32_t FRESH_BIT = 0x8;
+    static constexpr uint32_t NO_SLOT = ~0u;
+    static_assert(CAPTURE_POOL_SIZE <= INDEX_MASK + 1, "capture slot index does not fit INDEX_MASK");
+
+    uint32_t back = 0;
+    std::atomic<uint32_t> middle{1};
+    uint32_t front = 2;
+    std::array<uint32_t, CAPTURE_POOL_SIZE - 2> readerSlots = initReaderSlots();
+    std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> held = initHeldSlots();
+
+    static std::array<uint32_t, CAPTURE_POOL_SIZE - 2> initReaderSlots() {
+        std::array<uint32_t, CAPTURE_POOL_SIZE - 2> slots;
+        for (size_t i = 0; i < slots.size(); i++) {
+            slots[i] = static_cast<uint32_t>(i + 2);
+        }
+        return slots;
+    }
 
-        attrDesrc[1].binding = 0;
-        attrDesrc[1].location = 1;
-        attrDesrc[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attrDesrc[1].offset = offsetof(Vertex, color);
+    static std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> initHeldSlots() {
+        std::array<uint32_t, MAX_FRAMES_IN_FLIGHT> slots;
+        slots.fill(NO_SLOT);
+        return slots;
+    }
+};
 
-        attrDesrc[2].binding = 0;
-        attrDesrc[2].location = 2;
-        attrDesrc[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attrDesrc[2].offset = offsetof(Vertex, texCoord);
+// Fixed set of worker threads running queued tasks (image decoding overlapped with the Vulkan initialisation)
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned threadCount) {
+        for (unsigned i = 0; i < std::max(threadCount, 1u); i++) {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
 
-        return attrDesrc;
-    } 
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // the result (or the exception thrown by the task) is delivered through the future
+    template <typename Task>
+    auto submit(Task task) -> std::future<decltype(task())> {
+        auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+        std::future<decltype(task())> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back([packaged]() { (*packaged)(); });
+        }
+        wakeUp.notify_one();
+        return result;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopping = false;
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
 };
 
-struct UniformBufferObject {
-    alignas(16) glm::mat4 model;
-    alignas(16) glm::mat4 view;
-    alignas(16) glm::mat4 proj;
+class MappedFile;
+
+// RGBA8 pixels decoded by stb_image (freed with the struct) or mapped from a texture cache entry
+struct DecodedImage {
+    std::unique_ptr<stbi_uc, void (*)(void*)> pixels{nullptr, stbi_image_free};
+    std::shared_ptr<MappedFile> cached;
+    const stbi_uc* cachedPixels = nullptr;
+    int width = 0;
+    int height = 0;
+
+    const stbi_uc* data() const { return cached ? cachedPixels : pixels.get(); }
 };
 
-// ###VERTICES INFORMATION###
-const std::vector<Vertex> verticesQuad = {
-    {{-0.5625f, -1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
-    {{ 0.5625f, -1.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
-    {{ 0.5625f,  1.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
-    {{-0.5625f,  1.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}}
+// Identifies the decoded form of an encoded file: hash and size of its content plus the conversion applied.
+// The hash only names the entry, a hit is confirmed by comparing the content stored with it.
+struct TextureCacheKey {
+    uint64_t contentHash = 0;
+    uint64_t contentSize = 0;
+    uint32_t format = 0;
 };
 
-const std::vector<Vertex> verticesFull = {
-    {{-1.0f, -1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
-    {{ 1.0f, -1.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
-    {{ 1.0f,  1.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
-    {{-1.0f,  1.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}}
+// Compressed image file read into memory, with the size probed from its header
+struct EncodedImage {
+    std::string filename; // named by the decode errors
+    std::vector<stbi_uc> bytes;
+    int width = 0;
+    int height = 0;
+    TextureCacheKey cacheKey;
+    std::shared_ptr<MappedFile> cached; // texture cache entry holding the decoded pixels, if any
 };
 
-const std::vector<uint16_t> indices = {
-    0, 1, 2, 2, 3, 0
+// Destination of the decode running on this thread. stb_image allocates the final width * height * 4 image once
+// (PNG and JPEG alike) and writes the rows into it, so the first allocation of exactly that size is handed dst.
+struct StbiOutputTarget {
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    bool inUse = false;
 };
+static thread_local StbiOutputTarget stbiOutputTarget;
 
-class VkWarpApp {
-private:
-    GLFWwindow* window;
-    
-    // for real-time screen capturing
-    #if __linux__
-        Display *display;
-        Window root_window;
-        XImage *screenCapture;
-    #endif
-    VkInstance instance = 0;
-    VkDebugUtilsMessengerEXT debugMessenger;
-    VkSurfaceKHR surface;
-    
-    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    VkDevice logicalDevice;
-    
-    VkQueue graphicsQueue;
-    VkQueue presentQueue;
-    
-    VkSwapchainKHR swapChain;
-    std::vector<VkImage> swapChainImages;
-    VkFormat swapChainImageFormat;
-    VkExtent2D swapChainExtent;
-    std::vector<VkImageView> swapChainImageViews;
-    std::vector<VkFramebuffer> swapChainFramebuffers;
-    
-    VkRenderPass renderPass;
-    VkDescriptorSetLayout descriptorSetLayout;
-    VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
-    
-    VkCommandPool commandPool;
+static void* stbiMalloc(size_t size) {
+    if (stbiOutputTarget.data != nullptr && !stbiOutputTarget.inUse && size == stbiOutputTarget.size) {
+        stbiOutputTarget.inUse = true;
+        return stbiOutputTarget.data;
+    }
+    return malloc(size);
+}
 
-    VkImage uvMSTextureImage;
-    VkDeviceMemory uvMSTextureImageMemory;
-    VkImageView uvMSTextureImageView;
+static void* stbiRealloc(void* pointer, size_t size) {
+    if (pointer != nullptr && pointer == stbiOutputTarget.data) {
+        // the destination cannot grow, whatever was placed there moves to the heap
+        void* moved = malloc(size);
+        if (moved != nullptr) {
+            memcpy(moved, pointer, std::min(size, stbiOutputTarget.size));
+            stbiOutputTarget.inUse = false;
+        }
+        return moved;
+    }
+    return realloc(pointer, size);
+}
 
-    VkImage uvLSTextureImage;
-    VkDeviceMemory uvLSTextureImageMemory;
-    VkImageView uvLSTextureImageView;
+static void stbiFree(void* pointer) {
+    if (pointer != nullptr && pointer == stbiOutputTarget.data) {
+        stbiOutputTarget.inUse = false;
+        return;
+    }
+    free(pointer);
+}
 
-    VkImage colorTextureImage;
-    VkDeviceMemory colorTextureImageMemory;
-    VkImageView colorTextureImageView;
-    VkFormat colorTexFormat;
-    VkBuffer colorStagingBuffer;
-    VkDeviceMemory colorStagingBufferMemory;
-    
-    VkSampler textureSampler;
+static EncodedImage readImageFile(const std::string& filename, const char* error) {
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error(std::string(error) + ": " + filename);
+    }
+    EncodedImage image;
+    image.filename = filename;
+    image.bytes.resize((size_t) file.tellg());
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(image.bytes.data()), image.bytes.size());
+
+    int channels;
+    if (!stbi_info_from_memory(image.bytes.data(), static_cast<int>(image.bytes.size()), &image.width, &image.height, &channels)) {
+        throw std::runtime_error(std::string(error) + ": " + filename);
+    }
+    return image;
+}
 
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
-    VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+// Decoding as RGBA8 into dst (width * height * 4 bytes, e.g. mapped staging memory). The rows are written there directly,
+// falling back to a copy if the decoder ended up with its output elsewhere.
+static void decodeImageInto(const EncodedImage& encoded, uint8_t* dst, const char* error) {
+    size_t size = size_t(encoded.width) * encoded.height * 4;
+    stbiOutputTarget = {dst, size, false};
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load_from_memory(encoded.bytes.data(), static_cast<int>(encoded.bytes.size()), &width, &height, &channels, STBI_rgb_alpha);
+    if (pixels != nullptr && pixels != dst && width == encoded.width && height == encoded.height) {
+        memcpy(dst, pixels, size);
+    }
+    stbi_image_free(pixels); // nothing to free when the output is dst
+    stbiOutputTarget = StbiOutputTarget();
 
-    std::vector<VkBuffer> uniformBuffers;
-    std::vector<VkDeviceMemory> uniformBuffersMemory;
+    if (pixels == nullptr || width != encoded.width || height != encoded.height) {
+        throw std::runtime_error(std::string(error) + ": " + encoded.filename);
+    }
+}
 
-    VkDescriptorPool descriptorPool;
-    std::vector<VkDescriptorSet> descriptorSets;
-    std::array<VkWriteDescriptorSet, 4> writeDescriptorSets = {};
-    VkDescriptorImageInfo descriptorColorImageInfo = {};
-    
-    std::vector<VkCommandBuffer> commandBuffers;
-    
-    std::vector<VkSemaphore> imgAvailSemaphores;
-    std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkFence> inFlightFences;
-    size_t currentFrame = 0;
+// Input frames of a batch: the images of a directory, or the files matching a glob pattern, sorted by name
+static std::vector<std::string> listImageFiles(const std::string& input) {
+    std::vector<std::string> files;
+    if (std::filesystem::is_directory(input)) {
+        for (const auto& entry : std::filesystem::directory_iterator(input)) {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+            if (entry.is_regular_file() && (extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".bmp"
+                                            || extension == ".tga")) {
+                files.push_back(entry.path().string());
+            }
+        }
+    } else {
+        #if __linux__
+            glob_t matches;
+            if (glob(input.c_str(), 0, nullptr, &matches) == 0) {
+                files.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+            }
+            globfree(&matches);
+        #else
+            if (std::filesystem::is_regular_file(input)) {
+                files.push_back(input);
+            }
+        #endif
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
 
-    bool framebufferResized = false;
-    bool capture = false;
-    time_t globalStartTime;
-    int frameNumber = 0;
-    int warpType;
-    //const char* idMS = "texture/identityUVMS.png";
-    //const char* idLS = "texture/identityUVLS.png";
-    //const char* swMS = "texture/SimpleWarpUVMS.png";
-    //const char* swLS = "texture/SimpleWarpUVLS.png";
-    //const char* swiMS = "texture/SimpleWarpUVIdentityMS.png";
-    //const char* swiLS = "texture/SimpleWarpUVIdentityLS.png";
-    //const char* warpMS = "texture/WarpUVMS.png";
-    //const char* warpLS = "texture/WarpUVLS.png";
+static DecodedImage decodeImage(const std::string& filename, const char* error) {
+    DecodedImage image;
+    int channels;
+    image.pixels.reset(stbi_load(filename.c_str(), &image.width, &image.height, &channels, STBI_rgb_alpha));
+    if (!image.pixels) {
+        throw std::runtime_error(std::string(error) + ": " + filename);
+    }
+    return image;
+}
 
+// Read-only view of a whole file: memory-mapped on Linux (pages are read in on first access), read into memory elsewhere
+class MappedFile {
+public:
+    MappedFile(const std::string& filename, const char* error) {
+        #if __linux__
+            int fd = open(filename.c_str(), O_RDONLY);
+            struct stat fileStat;
+            if (fd < 0 || fstat(fd, &fileStat) != 0) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                throw std::runtime_error(std::string(error) + ": " + filename);
+            }
+            fileSize = static_cast<size_t>(fileStat.st_size);
+            void* mapping = fileSize > 0 ? mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            close(fd); // the mapping keeps its own reference to the file
+            if (mapping == MAP_FAILED) {
+                throw std::runtime_error(std::string(error) + ": " + filename);
+            }
+            madvise(mapping, fileSize, MADV_WILLNEED); // read-ahead of the whole file, it is copied front to back
+            fileData = static_cast<const uint8_t*>(mapping);
+        #else
+            std::ifstream file(filename, std::ios::ate | std::ios::binary);
+            if (!file.is_open()) {
+                throw std::runtime_error(std::string(error) + ": " + filename);
+            }
+            fileBytes.resize((size_t) file.tellg());
+            file.seekg(0);
+            file.read(reinterpret_cast<char*>(fileBytes.data()), fileBytes.size());
+            fileData = fileBytes.data();
+            fileSize = fileBytes.size();
+        #endif
+    }
 
-    // Initialising GLFW instance, attributes and creating window
-    void initWindow() {
+    ~MappedFile() {
         #if __linux__
-            display = XOpenDisplay(nullptr);
-            root_window = DefaultRootWindow(display);
+            munmap(const_cast<uint8_t*>(fileData), fileSize);
         #endif
+    }
 
-        glfwInit();
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
 
-        window = glfwCreateWindow(WIDTH, HEIGHT, "vkWarp", nullptr, nullptr);
-        glfwSetWindowUserPointer(window, this);
-        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
-    }
+    const uint8_t* data() const { return fileData; }
+    size_t size() const { return fileSize; }
 
-    static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
-        auto app = reinterpret_cast<VkWarpApp*>(glfwGetWindowUserPointer(window));
-        app->framebufferResized = true;
-    }
+private:
+    const uint8_t* fileData = nullptr;
+    size_t fileSize = 0;
+    std::vector<uint8_t> fileBytes;
+};
 
-    void initVulkan(bool fullscreen, const char* uvMSFilename, const char* uvLSFilename) {
-        createInstance();
-        std::cout << "Instance Created" << std::endl;
-        setupDebugCallback();
-        std::cout << "Debug Callback Setup Successful" << std::endl;
-        createSurface();
-        std::cout << "Surface Created" << std::endl;
-        pickPhysicalDevice();
-        std::cout << "Physical Device Picked" << std::endl;
-        createLogicalDevice();
-        std::cout << "Logical Device Created" << std::endl;
-        createSwapChain();
-        std::cout << "Swap Chain Created" << std::endl;
-        createImageViews();
-        std::cout << "Image Views Created" << std::endl;
-        createRenderPass();
-        std::cout << "Render Pass Created" << std::endl;
-        createDescriptorSetLayout();
-        std::cout << "Descriptor Set Layout Created" << std::endl;
-        createGraphicsPipeline();
-        std::cout << "Graphics Pipeline Created" << std::endl;
-        createFramebuffers();
-        std::cout << "Framebuffers Created" << std::endl;
-        createCommandPool();
-        std::cout << "Command Pool Created" << std::endl;
-        createTextureImage(uvMSFilename, uvLSFilename);
-        std::cout << "Texture Image Created" << std::endl;
-        createTextureImageView();
-        std::cout << "Texture Image View Created" << std::endl;
-        createTextureSampler();
-        std::cout << "Texture Image Sampler" << std::endl;
-        if (fullscreen){
-            createVertexBuffer(verticesFull);
-        } else {
-            createVertexBuffer(verticesQuad);
+// Written in front of every texture cache entry: the header, the dataSize bytes of pixels, then the contentSize bytes
+// of the encoded file they were decoded from
+struct TextureCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t contentHash;
+    uint64_t contentSize;
+    uint32_t format;
+    int32_t width;
+    int32_t height;
+    uint32_t reserved;
+    uint64_t dataSize;
+};
+const uint32_t TEXTURE_CACHE_MAGIC = 0x43545756; // "VWTC"
+const uint32_t TEXTURE_CACHE_VERSION = 2; // 2: encoded content stored after the pixels
+const uint32_t TEXTURE_CACHE_FORMAT_RGBA8 = 1; // stbi_load with STBI_rgb_alpha
+
+// Decoded images kept on disk (<dir>/<content hash>-<format>.vtc), so later runs map them instead of decoding
+// the PNG/JPG again. Entries are touched when used and the least recently used ones are evicted beyond maxBytes.
+// An entry is only used if the encoded content stored in it is the same as the file's, whatever its hash.
+// Used from the worker pool, the directory scans are serialised.
+class TextureCache {
+public:
+    void init(const std::string& cacheDir, uint64_t cacheMaxBytes) {
+        std::error_code error;
+        std::filesystem::create_directories(cacheDir, error);
+        if (error) {
+            std::cout << "texture cache disabled, cannot create " << cacheDir << std::endl;
+            return;
         }
-        std::cout << "Vertex Buffer Created" << std::endl;
-        createIndexBuffer();
-        std::cout << "Index Buffer Created" << std::endl;
-        createUniformBuffer();
-        std::cout << "Uniform Buffer Created" << std::endl;
-        createDescriptorPool();
-        std::cout << "Descriptor Pool Created" << std::endl;
-        createDescriptorSets();
-        std::cout << "Descriptor Sets Created" << std::endl;
-        createCommandBuffers();
-        std::cout << "Command Buffers Created" << std::endl;
-        createSyncObjs();
-        std::cout << "Semaphores Created" << std::endl;
+        dir = cacheDir;
+        maxBytes = cacheMaxBytes;
     }
 
-    void mainLoop() {
-       time(&globalStartTime);
+    bool enabled() const { return !dir.empty(); }
 
-        while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
-            drawFrame();
-        }
-        
-        vkDeviceWaitIdle(logicalDevice);
+    static TextureCacheKey key(const std::vector<stbi_uc>& bytes, uint32_t format) {
+        return {contentHash(bytes.data(), bytes.size()), bytes.size(), format};
     }
 
-    void cleanupSwapChain() {
-        for (auto framebuffer : swapChainFramebuffers) {
-            vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
-            std::cout << "Framebuffer Destroyed" << std::endl;
+    // Mapped entry decoded from bytes (pixels at sizeof(TextureCacheHeader)), nullptr on a miss
+    std::shared_ptr<MappedFile> find(const TextureCacheKey& key, const std::vector<stbi_uc>& bytes, int width, int height) {
+        if (!enabled()) {
+            return nullptr;
         }
+        std::string path = entryPath(key);
+        std::error_code error;
+        if (!std::filesystem::exists(path, error)) {
+            misses++;
+            return nullptr;
+        }
+        try {
+            auto entry = std::make_shared<MappedFile>(path, "failed to open texture cache entry!");
+            TextureCacheHeader header;
+            uint64_t dataSize = uint64_t(width) * height * 4;
+            if (entry->size() >= sizeof(header)) {
+                memcpy(&header, entry->data(), sizeof(header));
+                if (header.magic == TEXTURE_CACHE_MAGIC && header.version == TEXTURE_CACHE_VERSION && header.contentHash == key.contentHash
+                    && header.contentSize == key.contentSize && header.format == key.format && header.width == width && header.height == height
+                    && header.dataSize == dataSize && entry->size() - sizeof(header) >= dataSize + key.contentSize
+                    && memcmp(entry->data() + sizeof(header) + dataSize, bytes.data(), bytes.size()) == 0) {
+                    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error); // most recently used
+                    hits++;
+                    return entry;
+                }
+            }
+        } catch (const std::runtime_error&) {
+        }
+        std::cout << "invalid texture cache entry " << path << std::endl;
+        misses++;
+        return nullptr;
+    }
+
+    // Storing freshly decoded pixels (width * height * 4 bytes) with the encoded bytes they come from, then evicting down to maxBytes
+    void store(const TextureCacheKey& key, const std::vector<stbi_uc>& bytes, int width, int height, const uint8_t* pixels) {
+        TextureCacheHeader header = {};
+        header.magic = TEXTURE_CACHE_MAGIC;
+        header.version = TEXTURE_CACHE_VERSION;
+        header.contentHash = key.contentHash;
+        header.contentSize = key.contentSize;
+        header.format = key.format;
+        header.width = width;
+        header.height = height;
+        header.dataSize = uint64_t(width) * height * 4;
+        if (!enabled() || sizeof(header) + header.dataSize + header.contentSize > maxBytes) {
+            return;
+        }
+
+        // written aside and renamed, so another instance never maps a partial entry
+        std::string path = entryPath(key);
+        std::string tmpPath = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(pixels), header.dataSize);
+        file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        file.close();
+        if (!file || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::cout << "failed to write texture cache entry " << path << std::endl;
+            std::remove(tmpPath.c_str());
+            return;
+        }
+        stores++;
+        evict();
+    }
+
+    void report() {
+        if (!enabled()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t entries = 0;
+        uint64_t bytes = 0;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+            if (entry.path().extension() == ".vtc") {
+                entries++;
+                bytes += entry.file_size(error);
+            }
+        }
+        std::cout << "texture cache: " << hits << " hits, " << misses << " misses, " << stores << " stored, " << evictions << " evicted ("
+                  << entries << " entries, " << bytes / (1024.0 * 1024.0) << " of " << maxBytes / (1024.0 * 1024.0) << " MiB)" << std::endl;
+    }
+
+private:
+    std::string entryPath(const TextureCacheKey& key) const {
+        char name[48];
+        snprintf(name, sizeof(name), "%016llx-%u.vtc", static_cast<unsigned long long>(key.contentHash), key.format);
+        return (std::filesystem::path(dir) / name).string();
+    }
+
+    // Removing the least recently used entries until the cache fits in maxBytes
+    void evict() {
+        std::lock_guard<std::mutex> lock(mutex);
+        struct Entry {
+            std::filesystem::path path;
+            std::filesystem::file_time_type lastUse;
+            uint64_t size;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, error)) {
+            if (entry.path().extension() == ".vtc") {
+                Entry e = {entry.path(), entry.last_write_time(error), entry.file_size(error)};
+                total += e.size;
+                entries.push_back(e);
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+        for (size_t i = 0; i < entries.size() && total > maxBytes; i++) {
+            // a mapped entry stays readable after its removal
+            if (std::filesystem::remove(entries[i].path, error)) {
+                total -= entries[i].size;
+                evictions++;
+            }
+        }
+    }
+
+    std::string dir;
+    uint64_t maxBytes = 0;
+    std::mutex mutex;
+    std::atomic<uint32_t> hits{0};
+    std::atomic<uint32_t> misses{0};
+    std::atomic<uint32_t> stores{0};
+    std::atomic<uint32_t> evictions{0};
+};
+
+// Decoding an image file through the texture cache: a hit maps the stored pixels, a miss decodes and stores them
+static DecodedImage decodeImageCached(const std::string& filename, const char* error, TextureCache& cache) {
+    EncodedImage encoded = readImageFile(filename, error);
+    TextureCacheKey key = TextureCache::key(encoded.bytes, TEXTURE_CACHE_FORMAT_RGBA8);
+    DecodedImage image;
+    image.width = encoded.width;
+    image.height = encoded.height;
+    image.cached = cache.find(key, encoded.bytes, encoded.width, encoded.height);
+    if (image.cached) {
+        image.cachedPixels = image.cached->data() + sizeof(TextureCacheHeader);
+        return image;
+    }
+    int width, height, channels;
+    image.pixels.reset(stbi_load_from_memory(encoded.bytes.data(), static_cast<int>(encoded.bytes.size()), &width, &height, &channels, STBI_rgb_alpha));
+    if (!image.pixels || width != encoded.width || height != encoded.height) {
+        throw std::runtime_error(std::string(error) + ": " + filename);
+    }
+    cache.store(key, encoded.bytes, width, height, image.pixels.get());
+    return image;
+}
+
+// Recombining a decoded 8-bit MS/LS warp map pair into 16-bit u, v, intensity triples (MS << 8 | LS)
+static void combineWarpMapPair(const DecodedImage& uvMS, const DecodedImage& uvLS, std::vector<uint16_t>& uvi) {
+    if (uvLS.width != uvMS.width || uvLS.height != uvMS.height) {
+        throw std::runtime_error("uv MS and LS texture images have different sizes!");
+    }
+    const stbi_uc* uvMSPixels = uvMS.data();
+    const stbi_uc* uvLSPixels = uvLS.data();
+    size_t texelCount = size_t(uvMS.width) * uvMS.height;
+    uvi.resize(3 * texelCount);
+    for (size_t i = 0; i < texelCount; i++) {
+        uvi[3 * i + 0] = (uvMSPixels[4 * i + 0] << 8) | uvLSPixels[4 * i + 0];
+        uvi[3 * i + 1] = (uvMSPixels[4 * i + 1] << 8) | uvLSPixels[4 * i + 1];
+        uvi[3 * i + 2] = (uvMSPixels[4 * i + 2] << 8) | uvLSPixels[4 * i + 2];
+    }
+}
+
+// Packing u, v, intensity triples into R16G16_UNORM (or R32G32_SFLOAT) uv texels and R8_UNORM intensities
+static void packWarpTexels(const uint16_t* uvi, size_t texelCount, bool floatTexels, void* uvDst, uint8_t* intensityDst) {
+    for (size_t i = 0; i < texelCount; i++) {
+        if (floatTexels) {
+            float* texel = static_cast<float*>(uvDst) + 2 * i;
+            texel[0] = uvi[3 * i + 0] / 65535.0f;
+            texel[1] = uvi[3 * i + 1] / 65535.0f;
+        } else {
+            uint16_t* texel = static_cast<uint16_t*>(uvDst) + 2 * i;
+            texel[0] = uvi[3 * i + 0];
+            texel[1] = uvi[3 * i + 1];
+        }
+        intensityDst[i] = warpMapIntensityFromUnorm16(uvi[3 * i + 2]);
+    }
+}
+
+// Validating the header of a mapped .vwm file (WarpMapFormat.h), the texel data follows it
+static WarpMapHeader readWarpMapHeader(const MappedFile& file) {
+    WarpMapHeader header;
+    if (file.size() < sizeof(header)) {
+        throw std::runtime_error("invalid warp map file!");
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    uint32_t texelSize = warpMapTexelSize(header.precision);
+    if (header.magic != WARP_MAP_MAGIC || header.version != WARP_MAP_VERSION || header.layout != WARP_MAP_LAYOUT_UV_INTENSITY
+        || header.channels != WARP_MAP_CHANNELS || texelSize == 0 || header.levelCount == 0 || header.levelCount > WARP_MAP_MAX_LEVELS
+        || header.dataSize > file.size() - sizeof(header) || header.levels[0].width != header.width || header.levels[0].height != header.height) {
+        throw std::runtime_error("invalid warp map file!");
+    }
+    if (header.levelCount > warpMapLevelCount(header.width, header.height)) {
+        throw std::runtime_error("invalid warp map file!");
+    }
+    for (uint32_t level = 0; level < header.levelCount; level++) {
+        const WarpMapLevel& info = header.levels[level];
+        // each level has the extent of that mip level of the image (the copies must stay inside it), and
+        // vkCmdCopyBufferToImage wants offsets aligned to the texel size (and to 4 bytes on a transfer-only queue)
+        uint64_t texelCount = uint64_t(info.width) * info.height;
+        if (info.width != std::max(header.width >> level, 1u) || info.height != std::max(header.height >> level, 1u)
+            || info.size != texelCount * texelSize || info.offset % WARP_MAP_LEVEL_ALIGNMENT != 0
+            || info.offset > header.dataSize || info.size > header.dataSize - info.offset
+            || info.intensityOffset % WARP_MAP_LEVEL_ALIGNMENT != 0 || info.intensityOffset > header.dataSize
+            || texelCount > header.dataSize - info.intensityOffset) {
+            throw std::runtime_error("invalid warp map file!");
+        }
+    }
+    return header;
+}
+
+const VkFormat WARP_INTENSITY_FORMAT = VK_FORMAT_R8_UNORM;
+
+// Format of the uv image of a warp map, the intensity image is always WARP_INTENSITY_FORMAT
+static VkFormat warpMapFormat(uint32_t precision) {
+    switch (precision) {
+        case WARP_MAP_UNORM8: return VK_FORMAT_R8G8_UNORM;
+        case WARP_MAP_UNORM16: return VK_FORMAT_R16G16_UNORM;
+        case WARP_MAP_FLOAT16: return VK_FORMAT_R16G16_SFLOAT;
+        default: return VK_FORMAT_R32G32_SFLOAT;
+    }
+}
+
+// Warp map loaded again by the hot reload: the CPU copy plus the uv and intensity planes of every mip level in the
+// texture formats, read from the .vwm mapping or packed from the MS/LS pair
+struct WarpMapUpdate {
+    std::vector<uint16_t> uvi;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED; // of the uv image
+    uint32_t texelSize = 0;                // of the uv image
+    std::vector<WarpMapLevel> levels; // offsets relative to texels
+    const uint8_t* texels = nullptr;
+    std::shared_ptr<MappedFile> file;
+    std::vector<uint8_t> packed;
+};
+
+static std::shared_ptr<WarpMapUpdate> loadWarpMapUpdate(const std::string& warpMapFile, const std::string& msFilename, const std::string& lsFilename,
+                                                        bool floatTexels, TextureCache& cache) {
+    auto update = std::make_shared<WarpMapUpdate>();
+    if (!warpMapFile.empty()) {
+        update->file = std::make_shared<MappedFile>(warpMapFile, "failed to open warp map file!");
+        WarpMapHeader header = readWarpMapHeader(*update->file);
+        update->texels = update->file->data() + sizeof(header);
+        if (contentHash(update->texels, header.dataSize) != header.checksum) {
+            throw std::runtime_error("warp map file checksum mismatch!");
+        }
+        update->width = header.width;
+        update->height = header.height;
+        update->format = warpMapFormat(header.precision);
+        update->texelSize = warpMapTexelSize(header.precision);
+        update->levels.assign(header.levels, header.levels + header.levelCount);
+        update->uvi.resize(3 * size_t(header.width) * header.height);
+        const uint8_t* uv = update->texels + header.levels[0].offset;
+        const uint8_t* intensity = update->texels + header.levels[0].intensityOffset;
+        for (size_t i = 0; i < size_t(header.width) * header.height; i++) {
+            warpMapTexelToUnorm16(uv + i * update->texelSize, intensity[i], header.precision, &update->uvi[3 * i]);
+        }
+        return update;
+    }
+
+    DecodedImage uvMS = cache.enabled() ? decodeImageCached(msFilename, "failed to load uv MS texture image!", cache)
+                                        : decodeImage(msFilename, "failed to load uv MS texture image!");
+    DecodedImage uvLS = cache.enabled() ? decodeImageCached(lsFilename, "failed to load uv LS texture image!", cache)
+                                        : decodeImage(lsFilename, "failed to load uv LS texture image!");
+    combineWarpMapPair(uvMS, uvLS, update->uvi);
+    update->width = uvMS.width;
+    update->height = uvMS.height;
+    update->format = floatTexels ? VK_FORMAT_R32G32_SFLOAT : VK_FORMAT_R16G16_UNORM;
+    update->texelSize = floatTexels ? 2 * sizeof(float) : 2 * sizeof(uint16_t);
+    size_t texelCount = size_t(update->width) * update->height;
+    WarpMapLevel level = {};
+    level.size = texelCount * update->texelSize;
+    level.width = update->width;
+    level.height = update->height;
+    level.intensityOffset = level.size;
+    update->packed.resize(level.size + texelCount);
+    packWarpTexels(update->uvi.data(), texelCount, floatTexels, update->packed.data(), update->packed.data() + level.intensityOffset);
+    update->texels = update->packed.data();
+    update->levels.push_back(level);
+    return update;
+}
+
+// Bounding rectangle of the texels differing between two warp maps of the same size, false if they are identical
+static bool warpMapDifference(const std::vector<uint16_t>& a, const std::vector<uint16_t>& b, uint32_t width, uint32_t height, VkRect2D& rect) {
+    uint32_t x0 = width, x1 = 0, y0 = height, y1 = 0;
+    size_t rowValues = 3 * size_t(width);
+    for (uint32_t y = 0; y < height; y++) {
+        const uint16_t* rowA = &a[y * rowValues];
+        const uint16_t* rowB = &b[y * rowValues];
+        if (memcmp(rowA, rowB, rowValues * sizeof(uint16_t)) == 0) {
+            continue;
+        }
+        y0 = std::min(y0, y);
+        y1 = y + 1;
+        uint32_t first = 0, last = width;
+        while (memcmp(rowA + 3 * first, rowB + 3 * first, 3 * sizeof(uint16_t)) == 0) {
+            first++;
+        }
+        while (memcmp(rowA + 3 * (last - 1), rowB + 3 * (last - 1), 3 * sizeof(uint16_t)) == 0) {
+            last--;
+        }
+        x0 = std::min(x0, first);
+        x1 = std::max(x1, last);
+    }
+    if (y1 == 0) {
+        return false;
+    }
+    rect.offset = {static_cast<int32_t>(x0), static_cast<int32_t>(y0)};
+    rect.extent = {x1 - x0, y1 - y0};
+    return true;
+}
+
+// Copying the regions of update recorded for the upload (tightly packed, bufferOffset into staging) out of its texels:
+// uvRegions from the uv planes, intensityRegions from the intensity planes
+static void copyWarpMapRegions(const WarpMapUpdate& update, const std::vector<VkBufferImageCopy>& uvRegions,
+                               const std::vector<VkBufferImageCopy>& intensityRegions, uint8_t* staging) {
+    for (bool intensity : {false, true}) {
+        size_t texelSize = intensity ? 1 : update.texelSize;
+        for (const VkBufferImageCopy& region : intensity ? intensityRegions : uvRegions) {
+            const WarpMapLevel& level = update.levels[region.imageSubresource.mipLevel];
+            const uint8_t* plane = update.texels + (intensity ? level.intensityOffset : level.offset);
+            size_t rowBytes = size_t(region.imageExtent.width) * texelSize;
+            for (uint32_t row = 0; row < region.imageExtent.height; row++) {
+                size_t texel = size_t(region.imageOffset.y + row) * level.width + region.imageOffset.x;
+                memcpy(staging + region.bufferOffset + row * rowBytes, plane + texel * texelSize, rowBytes);
+            }
+        }
+    }
+}
+
+// Convex polygon (texture coordinates, counterclockwise) outside of which the intensity read from the warp map is zero:
+// hull of the texels with a non-zero intensity, widened by margin texels for the filter footprint and clipped to [0, 1]^2.
+// Fewer than 3 points if the whole map is black.
+static std::vector<glm::vec2> warpCoveragePolygon(const std::vector<uint16_t>& uvi, uint32_t width, uint32_t height, int64_t margin) {
+    // only the first and last lit texel of each row can be hull vertices (integer texel corners, so the hull is exact)
+    std::vector<std::pair<int64_t, int64_t>> points;
+    for (uint32_t y = 0; y < height; y++) {
+        const uint16_t* row = &uvi[3 * size_t(y) * width];
+        int64_t first = -1, last = -1;
+        for (uint32_t x = 0; x < width; x++) {
+            if (row[3 * x + 2] != 0) {
+                first = first < 0 ? x : first;
+                last = x;
+            }
+        }
+        if (first < 0) {
+            continue;
+        }
+        points.push_back({first - margin, y - margin});
+        points.push_back({first - margin, y + 1 + margin});
+        points.push_back({last + 1 + margin, y - margin});
+        points.push_back({last + 1 + margin, y + 1 + margin});
+    }
+
+    std::vector<glm::vec2> polygon;
+    if (points.empty()) {
+        return polygon;
+    }
+
+    // monotone chain, collinear points dropped
+    std::sort(points.begin(), points.end());
+    auto cross = [](const std::pair<int64_t, int64_t>& o, const std::pair<int64_t, int64_t>& a, const std::pair<int64_t, int64_t>& b) {
+        return (a.first - o.first) * (b.second - o.second) - (a.second - o.second) * (b.first - o.first);
+    };
+    std::vector<std::pair<int64_t, int64_t>> hull(2 * points.size());
+    size_t count = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        while (count >= 2 && cross(hull[count - 2], hull[count - 1], points[i]) <= 0) {
+            count--;
+        }
+        hull[count++] = points[i];
+    }
+    for (size_t i = points.size() - 1, lower = count + 1; i-- > 0;) {
+        while (count >= lower && cross(hull[count - 2], hull[count - 1], points[i]) <= 0) {
+            count--;
+        }
+        hull[count++] = points[i];
+    }
+    if (count < 4) {
+        return polygon;
+    }
+    for (size_t i = 0; i + 1 < count; i++) { // the last point closes the chain
+        polygon.push_back({float(hull[i].first) / width, float(hull[i].second) / height});
+    }
+
+    // Sutherland-Hodgman against the four sides of the quad
+    for (int side = 0; side < 4; side++) {
+        int axis = side & 1;
+        float bound = side < 2 ? 0.0f : 1.0f;
+        auto inside = [&](const glm::vec2& p) { return side < 2 ? p[axis] >= bound : p[axis] <= bound; };
+        std::vector<glm::vec2> clipped;
+        for (size_t i = 0; i < polygon.size(); i++) {
+            const glm::vec2& a = polygon[i];
+            const glm::vec2& b = polygon[(i + 1) % polygon.size()];
+            if (inside(a)) {
+                clipped.push_back(a);
+            }
+            if (inside(a) != inside(b)) {
+                glm::vec2 p = a + (b - a) * ((bound - a[axis]) / (b[axis] - a[axis]));
+                p[axis] = bound;
+                clipped.push_back(p);
+            }
+        }
+        polygon.swap(clipped);
+    }
+    return polygon;
+}
+
+// Capture counters shared between the capture thread and the render thread
+struct CaptureStats {
+    std::atomic<uint64_t> captured{0};      // frames published by the capture thread
+    std::atomic<uint64_t> dropped{0};       // published frames overwritten before drawFrame picked them up
+    std::atomic<uint64_t> captureMicros{0}; // time spent inside the X capture calls
+    std::atomic<uint64_t> hashMicros{0};    // time spent hashing capture tiles
+    uint64_t consumed = 0;                  // captured frames uploaded by drawFrame
+    uint64_t duplicated = 0;                // frames drawn without a new capture (previous one is shown again)
+    uint64_t unchanged = 0;                 // new captures with no dirty tile (upload skipped)
+    uint64_t dirtyTiles = 0;                // tiles uploaded
+    uint64_t checkedTiles = 0;              // tiles compared against the color texture contents
+    uint64_t drawnOutputTiles = 0;          // output tiles redrawn
+    uint64_t outputTiles = 0;               // output tiles presented
+};
+
+// Fragment shader decode modes, passed as specialization constant 0 (values must match WARP_MODE in shader.frag)
+enum WarpMode {
+    WARP_MODE_16BIT = 0,    // full 16-bit warp map
+    WARP_MODE_8BIT = 1,     // warp coordinates truncated to their most significant byte (legacy 8-bit maps)
+    WARP_MODE_NONE = 2,     // color texture mapped straight onto the quad
+    WARP_MODE_TEXCOORD = 3  // texture coordinates shown as colors (no texture mapping)
+};
+
+// CPU implementation of shader.frag (--cpu-warp): the reference the GPU output is validated against (--validate), and a
+// fallback for machines without a usable Vulkan device. Fixed point throughout, so that the scalar, SSE4.1 and AVX2 paths
+// give identical results: bilinear weights are quantised to 8 bits (as in the GPU texture units), warp values are 16-bit,
+// colors and intensity 8-bit. Only level 0 of the warp map is sampled (--validate limits the GPU to it as well).
+enum CpuWarpIsa { CPU_WARP_AUTO, CPU_WARP_SCALAR, CPU_WARP_SSE41, CPU_WARP_AVX2 };
+const uint32_t CPU_WARP_BAND_ROWS = 16; // output rows per task, the bands are picked up by the threads as they finish
+// --validate fails (nonzero exit) above either bound, in 8-bit color steps over the R, G and B channels. Filtering
+// precision differs by a step or two, the 8-bit intensity image by up to half a step, isolated edge texels may go further.
+const uint32_t VALIDATE_MAX_DIFFERENCE = 16;
+const double VALIDATE_MAX_MEAN_DIFFERENCE = 0.5;
+
+// a * (256 - weight) + b * weight, rounded back to the range of a and b (weight in 0..256)
+static inline uint32_t cpuWarpBlend(uint32_t a, uint32_t b, uint32_t weight) {
+    return (a * (256 - weight) + b * weight + 128) >> 8;
+}
+
+// Color texel pair and weight along one axis for a 16-bit texture coordinate (bilinear, REPEAT addressing like textureSampler).
+// coord + (coord >> 15) maps 65535 to 65536, so that the coordinate spans exactly size texels.
+static inline void cpuWarpColorTap(uint32_t coord, uint32_t size, int32_t& first, int32_t& second, uint32_t& weight) {
+    int32_t position = static_cast<int32_t>(((coord + (coord >> 15)) * size) >> 8) - 128; // texel centres at .5, 8 fractional bits
+    first = position >> 8;
+    second = first + 1;
+    weight = static_cast<uint32_t>(position) & 255;
+    if (first < 0) {
+        first = static_cast<int32_t>(size) - 1;
+    }
+    if (second == static_cast<int32_t>(size)) {
+        second = 0;
+    }
+}
+
+static void cpuWarpBlendRowsScalar(const uint16_t* a, const uint16_t* b, uint32_t weight, uint16_t* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = static_cast<uint16_t>(cpuWarpBlend(a[i], b[i], weight));
+    }
+}
+
+// u, v, intensity of the output pixels [begin, end) from one (vertically blended) warp row, first and second being
+// the offsets of the two texels of each pixel in the row
+static void cpuWarpSampleRowScalar(const uint16_t* row, const int32_t* first, const int32_t* second, const uint32_t* weight,
+                                   size_t begin, size_t end, uint32_t* u, uint32_t* v, uint32_t* intensity) {
+    for (size_t x = begin; x < end; x++) {
+        u[x] = cpuWarpBlend(row[first[x]], row[second[x]], weight[x]);
+        v[x] = cpuWarpBlend(row[first[x] + 1], row[second[x] + 1], weight[x]);
+        intensity[x] = cpuWarpBlend(row[first[x] + 2], row[second[x] + 2], weight[x]);
+    }
+}
+
+static void cpuWarpColorRowScalar(const uint8_t* color, uint32_t width, uint32_t height, const uint32_t* u, const uint32_t* v,
+                                  const uint32_t* intensity, bool applyIntensity, size_t begin, size_t end, uint8_t* out) {
+    for (size_t x = begin; x < end; x++) {
+        int32_t x0, x1, y0, y1;
+        uint32_t wx, wy;
+        cpuWarpColorTap(u[x], width, x0, x1, wx);
+        cpuWarpColorTap(v[x], height, y0, y1, wy);
+        const uint8_t* p00 = color + (size_t(y0) * width + x0) * 4;
+        const uint8_t* p01 = color + (size_t(y0) * width + x1) * 4;
+        const uint8_t* p10 = color + (size_t(y1) * width + x0) * 4;
+        const uint8_t* p11 = color + (size_t(y1) * width + x1) * 4;
+        uint32_t scale = (intensity[x] + 128) >> 8; // 0..256
+        for (int c = 0; c < 4; c++) {
+            uint32_t value = cpuWarpBlend(cpuWarpBlend(p00[c], p01[c], wx), cpuWarpBlend(p10[c], p11[c], wx), wy);
+            out[4 * x + c] = static_cast<uint8_t>(applyIntensity ? (value * scale + 128) >> 8 : value);
+        }
+    }
+}
+
+// The vector paths process whole groups of 4 (SSE4.1) or 8 (AVX2) pixels and return where they stopped, the scalar
+// functions finish the row
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1")))
+static void cpuWarpBlendRowsSse41(const uint16_t* a, const uint16_t* b, uint32_t weight, uint16_t* dst, size_t count) {
+    const __m128i weightA = _mm_set1_epi32(256 - weight), weightB = _mm_set1_epi32(weight), half = _mm_set1_epi32(128);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(_mm_cvtepu16_epi32(va), weightA), _mm_mullo_epi32(_mm_cvtepu16_epi32(vb), weightB)), half);
+        __m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(va, 8)), weightA),
+                                                 _mm_mullo_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(vb, 8)), weightB)), half);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi32(_mm_srli_epi32(lo, 8), _mm_srli_epi32(hi, 8)));
+    }
+    cpuWarpBlendRowsScalar(a + i, b + i, weight, dst + i, count - i);
+}
+
+__attribute__((target("sse4.1")))
+static inline void cpuWarpColorTapSse41(__m128i coord, __m128i size, __m128i& first, __m128i& second, __m128i& weight) {
+    __m128i position = _mm_sub_epi32(_mm_srli_epi32(_mm_mullo_epi32(_mm_add_epi32(coord, _mm_srli_epi32(coord, 15)), size), 8), _mm_set1_epi32(128));
+    first = _mm_srai_epi32(position, 8);
+    second = _mm_add_epi32(first, _mm_set1_epi32(1));
+    weight = _mm_and_si128(position, _mm_set1_epi32(255));
+    first = _mm_blendv_epi8(first, _mm_sub_epi32(size, _mm_set1_epi32(1)), _mm_cmplt_epi32(first, _mm_setzero_si128()));
+    second = _mm_andnot_si128(_mm_cmpeq_epi32(second, size), second);
+}
+
+// 32-bit per-pixel values (at most 256) repeated over the four 16-bit channel lanes of pixels 0-1 (lo) and 2-3 (hi)
+__attribute__((target("sse4.1")))
+static inline void cpuWarpSpreadSse41(__m128i values, __m128i& lo, __m128i& hi) {
+    __m128i pairs = _mm_or_si128(values, _mm_slli_epi32(values, 16));
+    lo = _mm_unpacklo_epi32(pairs, pairs);
+    hi = _mm_unpackhi_epi32(pairs, pairs);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i cpuWarpBlendSse41(__m128i a, __m128i b, __m128i weight) {
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(_mm_set1_epi16(256), weight)), _mm_mullo_epi16(b, weight));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+}
+
+// no gathers before AVX2, the four pixels are loaded one at a time
+__attribute__((target("sse4.1")))
+static inline __m128i cpuWarpGatherSse41(const uint8_t* color, __m128i index) {
+    alignas(16) int32_t indices[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+    uint32_t pixels[4];
+    for (int i = 0; i < 4; i++) {
+        memcpy(&pixels[i], color + size_t(indices[i]) * 4, sizeof(uint32_t));
+    }
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+}
+
+__attribute__((target("sse4.1")))
+static size_t cpuWarpColorRowSse41(const uint8_t* color, uint32_t width, uint32_t height, const uint32_t* u, const uint32_t* v,
+                                   const uint32_t* intensity, bool applyIntensity, size_t begin, size_t end, uint8_t* out) {
+    const __m128i zero = _mm_setzero_si128(), widths = _mm_set1_epi32(width), heights = _mm_set1_epi32(height);
+    size_t x = begin;
+    for (; x + 4 <= end; x += 4) {
+        __m128i x0, x1, wx, y0, y1, wy;
+        cpuWarpColorTapSse41(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x)), widths, x0, x1, wx);
+        cpuWarpColorTapSse41(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x)), heights, y0, y1, wy);
+        __m128i row0 = _mm_mullo_epi32(y0, widths), row1 = _mm_mullo_epi32(y1, widths);
+        __m128i p00 = cpuWarpGatherSse41(color, _mm_add_epi32(row0, x0));
+        __m128i p01 = cpuWarpGatherSse41(color, _mm_add_epi32(row0, x1));
+        __m128i p10 = cpuWarpGatherSse41(color, _mm_add_epi32(row1, x0));
+        __m128i p11 = cpuWarpGatherSse41(color, _mm_add_epi32(row1, x1));
+
+        __m128i wxLo, wxHi, wyLo, wyHi;
+        cpuWarpSpreadSse41(wx, wxLo, wxHi);
+        cpuWarpSpreadSse41(wy, wyLo, wyHi);
+        __m128i lo = cpuWarpBlendSse41(cpuWarpBlendSse41(_mm_unpacklo_epi8(p00, zero), _mm_unpacklo_epi8(p01, zero), wxLo),
+                                       cpuWarpBlendSse41(_mm_unpacklo_epi8(p10, zero), _mm_unpacklo_epi8(p11, zero), wxLo), wyLo);
+        __m128i hi = cpuWarpBlendSse41(cpuWarpBlendSse41(_mm_unpackhi_epi8(p00, zero), _mm_unpackhi_epi8(p01, zero), wxHi),
+                                       cpuWarpBlendSse41(_mm_unpackhi_epi8(p10, zero), _mm_unpackhi_epi8(p11, zero), wxHi), wyHi);
+        if (applyIntensity) {
+            __m128i scale = _mm_srli_epi32(_mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(intensity + x)), _mm_set1_epi32(128)), 8);
+            __m128i scaleLo, scaleHi;
+            cpuWarpSpreadSse41(scale, scaleLo, scaleHi);
+            lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, scaleLo), _mm_set1_epi16(128)), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, scaleHi), _mm_set1_epi16(128)), 8);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * x), _mm_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static void cpuWarpBlendRowsAvx2(const uint16_t* a, const uint16_t* b, uint32_t weight, uint16_t* dst, size_t count) {
+    const __m256i weightA = _mm256_set1_epi32(256 - weight), weightB = _mm256_set1_epi32(weight), half = _mm256_set1_epi32(128);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i blended[2];
+        for (int j = 0; j < 2; j++) {
+            __m256i va = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 8 * j)));
+            __m256i vb = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 8 * j)));
+            blended[j] = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(va, weightA), _mm256_mullo_epi32(vb, weightB)), half), 8);
+        }
+        // the pack works within 128-bit lanes, the permutation puts the four quarters back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(blended[0], blended[1]), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+    cpuWarpBlendRowsScalar(a + i, b + i, weight, dst + i, count - i);
+}
+
+// the row must be readable 2 bytes past its last value (32-bit gathers of 16-bit values)
+__attribute__((target("avx2")))
+static size_t cpuWarpSampleRowAvx2(const uint16_t* row, const int32_t* first, const int32_t* second, const uint32_t* weight,
+                                   size_t begin, size_t end, uint32_t* u, uint32_t* v, uint32_t* intensity) {
+    const __m256i low16 = _mm256_set1_epi32(0xffff), half = _mm256_set1_epi32(128), full = _mm256_set1_epi32(256);
+    uint32_t* outputs[3] = {u, v, intensity};
+    size_t x = begin;
+    for (; x + 8 <= end; x += 8) {
+        __m256i firsts = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + x));
+        __m256i seconds = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(second + x));
+        __m256i weightB = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weight + x));
+        __m256i weightA = _mm256_sub_epi32(full, weightB);
+        for (int c = 0; c < 3; c++) {
+            const int* base = reinterpret_cast<const int*>(row + c);
+            __m256i a = _mm256_and_si256(_mm256_i32gather_epi32(base, firsts, 2), low16);
+            __m256i b = _mm256_and_si256(_mm256_i32gather_epi32(base, seconds, 2), low16);
+            __m256i blended = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(a, weightA), _mm256_mullo_epi32(b, weightB)), half), 8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(outputs[c] + x), blended);
+        }
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static inline void cpuWarpColorTapAvx2(__m256i coord, __m256i size, __m256i& first, __m256i& second, __m256i& weight) {
+    __m256i position = _mm256_sub_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_add_epi32(coord, _mm256_srli_epi32(coord, 15)), size), 8),
+                                        _mm256_set1_epi32(128));
+    first = _mm256_srai_epi32(position, 8);
+    second = _mm256_add_epi32(first, _mm256_set1_epi32(1));
+    weight = _mm256_and_si256(position, _mm256_set1_epi32(255));
+    first = _mm256_blendv_epi8(first, _mm256_sub_epi32(size, _mm256_set1_epi32(1)), _mm256_cmpgt_epi32(_mm256_setzero_si256(), first));
+    second = _mm256_andnot_si256(_mm256_cmpeq_epi32(second, size), second);
+}
+
+// same as cpuWarpSpreadSse41 within each 128-bit lane: pixels 0-1 and 4-5 (lo), 2-3 and 6-7 (hi), like the byte unpacks
+__attribute__((target("avx2")))
+static inline void cpuWarpSpreadAvx2(__m256i values, __m256i& lo, __m256i& hi) {
+    __m256i pairs = _mm256_or_si256(values, _mm256_slli_epi32(values, 16));
+    lo = _mm256_unpacklo_epi32(pairs, pairs);
+    hi = _mm256_unpackhi_epi32(pairs, pairs);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i cpuWarpBlendAvx2(__m256i a, __m256i b, __m256i weight) {
+    __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(a, _mm256_sub_epi16(_mm256_set1_epi16(256), weight)), _mm256_mullo_epi16(b, weight));
+    return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(128)), 8);
+}
+
+__attribute__((target("avx2")))
+static size_t cpuWarpColorRowAvx2(const uint8_t* color, uint32_t width, uint32_t height, const uint32_t* u, const uint32_t* v,
+                                  const uint32_t* intensity, bool applyIntensity, size_t begin, size_t end, uint8_t* out) {
+    const __m256i zero = _mm256_setzero_si256(), widths = _mm256_set1_epi32(width), heights = _mm256_set1_epi32(height);
+    const int* pixels = reinterpret_cast<const int*>(color);
+    size_t x = begin;
+    for (; x + 8 <= end; x += 8) {
+        __m256i x0, x1, wx, y0, y1, wy;
+        cpuWarpColorTapAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(u + x)), widths, x0, x1, wx);
+        cpuWarpColorTapAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + x)), heights, y0, y1, wy);
+        __m256i row0 = _mm256_mullo_epi32(y0, widths), row1 = _mm256_mullo_epi32(y1, widths);
+        __m256i p00 = _mm256_i32gather_epi32(pixels, _mm256_add_epi32(row0, x0), 4);
+        __m256i p01 = _mm256_i32gather_epi32(pixels, _mm256_add_epi32(row0, x1), 4);
+        __m256i p10 = _mm256_i32gather_epi32(pixels, _mm256_add_epi32(row1, x0), 4);
+        __m256i p11 = _mm256_i32gather_epi32(pixels, _mm256_add_epi32(row1, x1), 4);
+
+        __m256i wxLo, wxHi, wyLo, wyHi;
+        cpuWarpSpreadAvx2(wx, wxLo, wxHi);
+        cpuWarpSpreadAvx2(wy, wyLo, wyHi);
+        __m256i lo = cpuWarpBlendAvx2(cpuWarpBlendAvx2(_mm256_unpacklo_epi8(p00, zero), _mm256_unpacklo_epi8(p01, zero), wxLo),
+                                      cpuWarpBlendAvx2(_mm256_unpacklo_epi8(p10, zero), _mm256_unpacklo_epi8(p11, zero), wxLo), wyLo);
+        __m256i hi = cpuWarpBlendAvx2(cpuWarpBlendAvx2(_mm256_unpackhi_epi8(p00, zero), _mm256_unpackhi_epi8(p01, zero), wxHi),
+                                      cpuWarpBlendAvx2(_mm256_unpackhi_epi8(p10, zero), _mm256_unpackhi_epi8(p11, zero), wxHi), wyHi);
+        if (applyIntensity) {
+            __m256i scale = _mm256_srli_epi32(_mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(intensity + x)),
+                                                               _mm256_set1_epi32(128)), 8);
+            __m256i scaleLo, scaleHi;
+            cpuWarpSpreadAvx2(scale, scaleLo, scaleHi);
+            lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(lo, scaleLo), _mm256_set1_epi16(128)), 8);
+            hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(hi, scaleHi), _mm256_set1_epi16(128)), 8);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4 * x), _mm256_packus_epi16(lo, hi));
+    }
+    return x;
+}
+#endif
+
+// Warps a color image into an output image the way the graphics pipeline does (quad, fragment shader, render pass clear).
+// The per-column and per-row sampling positions are computed once by init, rows are then warped in two stages: the warp
+// map is sampled into u, v, intensity rows (vertical blend of two warp rows, then horizontal), then the color image.
+class CpuWarpEngine {
+public:
+    struct Settings {
+        WarpMode mode = WARP_MODE_16BIT;
+        bool applyIntensity = true;
+        bool nearestWarp = false;
+        glm::vec2 quadMin = {-1.0f, -1.0f}; // quad corners in normalised device coordinates (texCoord (0, 0) and (1, 1))
+        glm::vec2 quadMax = {1.0f, 1.0f};
+        uint32_t outputWidth = WIDTH;
+        uint32_t outputHeight = HEIGHT;
+    };
+
+    // uvi: 16-bit u, v, intensity per texel of the warp map
+    void init(const std::vector<uint16_t>& uvi, uint32_t width, uint32_t height, const Settings& warpSettings) {
+        settings = warpSettings;
+        warpWidth = width;
+        warpHeight = height;
+        warpTexels = uvi;
+        warpTexels.push_back(0); // read (and discarded) by the AVX2 gathers of the last value
+        buildTaps(settings.outputWidth, settings.quadMin.x, settings.quadMax.x, warpWidth, 3, settings.nearestWarp, columnFirst, columnSecond, columnWeight,
+                  columnCoords, columnBegin, columnEnd);
+        buildTaps(settings.outputHeight, settings.quadMin.y, settings.quadMax.y, warpHeight, 3 * warpWidth, settings.nearestWarp, rowFirst, rowSecond, rowWeight,
+                  rowCoords, rowBegin, rowEnd);
+    }
+
+    // Warping an RGBA8 image into output (outputWidth * outputHeight RGBA8), bands of rows spread over threads tasks of the pool
+    void warp(const uint8_t* color, uint32_t colorWidth, uint32_t colorHeight, uint8_t* output, CpuWarpIsa isa, WorkerPool& pool,
+              unsigned threads) const {
+        if (isa == CPU_WARP_AUTO) {
+            isa = best();
+        }
+        uint32_t bands = (settings.outputHeight + CPU_WARP_BAND_ROWS - 1) / CPU_WARP_BAND_ROWS;
+        std::atomic<uint32_t> nextBand{0};
+        std::vector<std::future<void>> tasks;
+        for (unsigned t = 0; t < std::max(threads, 1u); t++) {
+            tasks.push_back(pool.submit([&]() {
+                Scratch scratch;
+                scratch.warpRow.resize(3 * size_t(warpWidth) + 1);
+                scratch.u.resize(settings.outputWidth);
+                scratch.v.resize(settings.outputWidth);
+                scratch.intensity.resize(settings.outputWidth);
+                for (uint32_t band = nextBand++; band < bands; band = nextBand++) {
+                    uint32_t rowsEnd = std::min((band + 1) * CPU_WARP_BAND_ROWS, settings.outputHeight);
+                    for (uint32_t y = band * CPU_WARP_BAND_ROWS; y < rowsEnd; y++) {
+                        warpRow(y, color, colorWidth, colorHeight, output + size_t(y) * settings.outputWidth * 4, isa, scratch);
+                    }
+                }
+            }));
+        }
+        // every task refers to this frame, they all have to be done before a failure is reported
+        for (auto& task : tasks) {
+            task.wait();
+        }
+        for (auto& task : tasks) {
+            task.get();
+        }
+    }
+
+    static bool supported(CpuWarpIsa isa) {
+        switch (isa) {
+            case CPU_WARP_SCALAR:
+                return true;
+            #if defined(__x86_64__) || defined(__i386__)
+            case CPU_WARP_SSE41:
+                return __builtin_cpu_supports("sse4.1");
+            case CPU_WARP_AVX2:
+                return __builtin_cpu_supports("avx2");
+            #endif
+            default:
+                return false;
+        }
+    }
+
+    static CpuWarpIsa best() {
+        return supported(CPU_WARP_AVX2) ? CPU_WARP_AVX2 : supported(CPU_WARP_SSE41) ? CPU_WARP_SSE41 : CPU_WARP_SCALAR;
+    }
+
+    static const char* name(CpuWarpIsa isa) {
+        switch (isa) {
+            case CPU_WARP_SCALAR: return "scalar";
+            case CPU_WARP_SSE41: return "SSE4.1";
+            case CPU_WARP_AVX2: return "AVX2";
+            default: return "auto";
+        }
+    }
+
+private:
+    struct Scratch {
+        std::vector<uint16_t> warpRow; // vertically blended warp row
+        std::vector<uint32_t> u;
+        std::vector<uint32_t> v;
+        std::vector<uint32_t> intensity;
+    };
+
+    Settings settings;
+    std::vector<uint16_t> warpTexels;
+    uint32_t warpWidth = 0;
+    uint32_t warpHeight = 0;
+    // for every output column (row): offsets of the two warp texels (rows) it blends and the weight of the second one,
+    // its texture coordinate as a 16-bit value, and the range of columns (rows) covered by the quad
+    std::vector<int32_t> columnFirst, columnSecond, rowFirst, rowSecond;
+    std::vector<uint32_t> columnWeight, rowWeight;
+    std::vector<uint16_t> columnCoords, rowCoords;
+    uint32_t columnBegin = 0, columnEnd = 0, rowBegin = 0, rowEnd = 0;
+
+    // The texture coordinate varies linearly across the quad, so each axis is sampled independently (warpSampler: CLAMP_TO_EDGE)
+    static void buildTaps(uint32_t outputSize, float quadMin, float quadMax, uint32_t warpSize, int32_t stride, bool nearest, std::vector<int32_t>& first,
+                          std::vector<int32_t>& second, std::vector<uint32_t>& weight, std::vector<uint16_t>& coords, uint32_t& begin,
+                          uint32_t& end) {
+        first.resize(outputSize);
+        second.resize(outputSize);
+        weight.resize(outputSize);
+        coords.resize(outputSize);
+        begin = outputSize;
+        end = 0;
+        int32_t last = static_cast<int32_t>(warpSize) - 1;
+        for (uint32_t i = 0; i < outputSize; i++) {
+            float position = 2.0f * (i + 0.5f) / outputSize - 1.0f; // pixel centre
+            float s = (position - quadMin) / (quadMax - quadMin);
+            if (s >= 0.0f && s < 1.0f) {
+                begin = std::min(begin, i);
+                end = i + 1;
+            }
+            s = std::min(std::max(s, 0.0f), 1.0f);
+            int32_t t0, t1;
+            uint32_t w = 0;
+            if (nearest) {
+                t0 = t1 = std::min(static_cast<int32_t>(s * warpSize), last);
+            } else {
+                int32_t texel = static_cast<int32_t>(std::lround((s * warpSize - 0.5f) * 256.0f)); // 8 fractional bits
+                t0 = texel >> 8;
+                w = static_cast<uint32_t>(texel) & 255;
+                t1 = std::min(std::max(t0 + 1, 0), last);
+                t0 = std::min(std::max(t0, 0), last);
+            }
+            first[i] = t0 * stride;
+            second[i] = t1 * stride;
+            weight[i] = w;
+            coords[i] = static_cast<uint16_t>(std::lround(s * 65535.0f));
+        }
+        if (begin >= end) {
+            begin = end = 0;
+        }
+    }
+
+    void warpRow(uint32_t y, const uint8_t* color, uint32_t colorWidth, uint32_t colorHeight, uint8_t* out, CpuWarpIsa isa,
+                 Scratch& scratch) const {
+        uint32_t width = settings.outputWidth;
+        uint32_t begin = (y >= rowBegin && y < rowEnd) ? columnBegin : 0;
+        uint32_t end = (y >= rowBegin && y < rowEnd) ? columnEnd : 0;
+        // outside the quad: the clear color of the render pass
+        for (uint32_t x = 0; x < width; x++) {
+            if (x == begin) {
+                x = end;
+                if (x == width) {
+                    break;
+                }
+            }
+            out[4 * x] = out[4 * x + 1] = out[4 * x + 2] = 0;
+            out[4 * x + 3] = 255;
+        }
+        if (begin == end) {
+            return;
+        }
+
+        if (settings.mode == WARP_MODE_TEXCOORD) {
+            for (uint32_t x = begin; x < end; x++) {
+                out[4 * x] = static_cast<uint8_t>((columnCoords[x] + 128) / 257);
+                out[4 * x + 1] = static_cast<uint8_t>((rowCoords[y] + 128) / 257);
+                out[4 * x + 2] = 0;
+                out[4 * x + 3] = 255;
+            }
+            return;
+        }
+
+        uint32_t* u = scratch.u.data();
+        uint32_t* v = scratch.v.data();
+        uint32_t* intensity = scratch.intensity.data();
+        bool applyIntensity = settings.applyIntensity;
+        if (settings.mode == WARP_MODE_NONE) {
+            // the color image is mapped straight onto the quad
+            for (uint32_t x = begin; x < end; x++) {
+                u[x] = columnCoords[x];
+                v[x] = rowCoords[y];
+            }
+            applyIntensity = false;
+        } else {
+            const uint16_t* row = &warpTexels[rowFirst[y]];
+            if (rowWeight[y] != 0 && rowSecond[y] != rowFirst[y]) {
+                size_t count = 3 * size_t(warpWidth);
+                #if defined(__x86_64__) || defined(__i386__)
+                    if (isa == CPU_WARP_AVX2) {
+                        cpuWarpBlendRowsAvx2(row, &warpTexels[rowSecond[y]], rowWeight[y], scratch.warpRow.data(), count);
+                    } else if (isa == CPU_WARP_SSE41) {
+                        cpuWarpBlendRowsSse41(row, &warpTexels[rowSecond[y]], rowWeight[y], scratch.warpRow.data(), count);
+                    } else
+                #endif
+                cpuWarpBlendRowsScalar(row, &warpTexels[rowSecond[y]], rowWeight[y], scratch.warpRow.data(), count);
+                row = scratch.warpRow.data();
+            }
+
+            size_t x = begin;
+            #if defined(__x86_64__) || defined(__i386__)
+                if (isa == CPU_WARP_AVX2) {
+                    x = cpuWarpSampleRowAvx2(row, columnFirst.data(), columnSecond.data(), columnWeight.data(), begin, end, u, v, intensity);
+                }
+            #endif
+            cpuWarpSampleRowScalar(row, columnFirst.data(), columnSecond.data(), columnWeight.data(), x, end, u, v, intensity);
+
+            if (settings.mode == WARP_MODE_8BIT) {
+                // most significant byte only, as floor(uv * 65535 / 256) / 255 in the shader
+                for (uint32_t i = begin; i < end; i++) {
+                    u[i] = (u[i] >> 8) * 257;
+                    v[i] = (v[i] >> 8) * 257;
+                }
+            }
+        }
+
+        size_t x = begin;
+        #if defined(__x86_64__) || defined(__i386__)
+            if (isa == CPU_WARP_AVX2) {
+                x = cpuWarpColorRowAvx2(color, colorWidth, colorHeight, u, v, intensity, applyIntensity, begin, end, out);
+            } else if (isa == CPU_WARP_SSE41) {
+                x = cpuWarpColorRowSse41(color, colorWidth, colorHeight, u, v, intensity, applyIntensity, begin, end, out);
+            }
+        #endif
+        cpuWarpColorRowScalar(color, colorWidth, colorHeight, u, v, intensity, applyIntensity, x, end, out);
+    }
+};
+
+// Optional "--flag" command line settings (the positional arguments keep their meaning)
+struct VkWarpOptions {
+    bool importHostMemory = false; // --import-host-memory: upload captures straight from the shared memory (VK_EXT_external_memory_host)
+    bool transferQueue = true; // --no-transfer-queue: upload captures and warp reloads on the graphics queue even if a transfer-only family exists
+    bool damageTracking = true; // --no-damage-tracking: redraw the whole output every frame
+    bool floatWarpMap = false; // --float-warp-map: R32G32_SFLOAT uv texture instead of R16G16_UNORM
+    WarpMode warpMode = WARP_MODE_16BIT; // --warp-mode=16|8|none|texcoord
+    bool applyIntensity = true; // --no-intensity: ignore the intensity channel of the warp map
+    bool nearestWarp = false; // --nearest-warp: read the nearest warp texel instead of the filtered warp map
+    bool pipelineCache = true; // --no-pipeline-cache: neither load nor store pipeline_cache.bin
+    std::string spirvDir; // --spirv-dir=<dir>: load vert.spv and frag.spv from <dir> instead of the embedded SPIR-V
+    std::string warpMapFile; // --warp-map=<file.vwm>: precomputed warp map (WarpMapFormat.h) instead of the MS/LS pair
+    std::string writeWarpMapFile; // --write-warp-map=<file.vwm>: store the MS/LS pair as a .vwm with its mip chain
+    bool textureCache = true; // --no-texture-cache: always decode the PNG/JPG inputs
+    std::string textureCacheDir = "texture_cache"; // --texture-cache=<dir>: where decoded images are kept
+    uint64_t textureCacheMaxBytes = 256ull << 20; // --texture-cache-size=<MiB>: least recently used entries are evicted beyond it
+    bool watchWarpMap = false; // --watch-warp-map: reload the warp map files when they change (inotify)
+    bool headless = false; // --headless: render into offscreen images read back to host memory, without window, surface or swap chain
+    uint32_t frames = 1; // --frames=<n>: frames rendered in headless mode
+    std::string outputFile; // --output=<file.png>: where the last headless frame is written
+    uint32_t outputWidth = WIDTH; // --output-size=<width>x<height>: size of the headless render targets
+    uint32_t outputHeight = HEIGHT;
+    std::string colorImageFile = "/home/eldomo/Desktop/domeCalibration1k3.jpg"; // --color-image=<file>: image warped when not capturing
+    std::string batchInput; // --batch=<dir|glob>: warp every image of a directory (or matching a glob) headless, then exit
+    std::string batchOutputDir = "warped"; // --batch-output=<dir>: where the warped frames are written (as PNG, same names)
+    uint32_t batchDepth = 6; // --batch-depth=<n>: frames between decode and encode at once, which bounds the memory used
+    bool cpuWarp = false; // --cpu-warp[=scalar|sse4|avx2]: warp --frames frames on the CPU (CpuWarpEngine) instead of the GPU, then exit
+    CpuWarpIsa cpuWarpIsa = CPU_WARP_AUTO;
+    bool cpuWarpBenchmark = false; // --cpu-warp-benchmark: time every CPU warp path supported, single and multithreaded
+    bool validate = false; // --validate: compare the last headless frame against the CPU warp of the same inputs (exits with failure when they differ)
+    bool coverageMesh = true; // --no-coverage-mesh: shade the whole quad, even where the warp map intensity is zero
+    bool meshWarp = false; // --mesh-warp[=<pixels>]: draw a mesh fitted to the warp map (buildWarpMesh) instead of sampling it per pixel
+    float meshWarpMaxError = 0.5f; // largest error of the mesh u, v, in color texture pixels
+};
+
+// Written in front of the VkPipelineCache data: the cache is only reused by the same device, driver and shaders
+struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t shaderHash; // shaderCodeHash, the same for the same SPIR-V on any machine
+    uint32_t dataSize;
+    uint32_t reserved;   // no padding, headers are compared with memcmp
+};
+const uint32_t PIPELINE_CACHE_MAGIC = 0x43505756; // "VWPC"
+
+// Object retired while frames using it may still be in flight, destroyed once every frame up to lastUseFrame has completed
+struct DeferredDeletion {
+    uint64_t lastUseFrame;
+    std::function<void()> destroy;
+};
+
+// Range of a VkDeviceMemory block handed out by DeviceMemoryAllocator
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;          // bytes taken from the block (rounded up by the strategy)
+    VkDeviceSize requestedSize = 0; // bytes asked by the resource
+    void* mapped = nullptr;         // persistently mapped pointer when the memory is host visible
+    uint32_t memoryType = 0;
+    uint32_t block = 0;
+};
+
+// Warp map on the GPU: u, v in a two-channel image (R16G16_UNORM, or as stored in a .vwm) and the intensity in an
+// R8_UNORM one, 5 bytes per 16-bit texel instead of 8. The fragment shader only reads the intensity when it applies it.
+struct WarpTexture {
+    VkImage uvImage = VK_NULL_HANDLE;
+    MemoryAllocation uvMemory;
+    VkImageView uvView = VK_NULL_HANDLE;
+    VkImage intensityImage = VK_NULL_HANDLE;
+    MemoryAllocation intensityMemory;
+    VkImageView intensityView = VK_NULL_HANDLE;
+};
+
+enum AllocationStrategy {
+    ALLOCATION_BUDDY,  // long-lived resources: power-of-two ranges, merged back with their buddy when freed
+    ALLOCATION_LINEAR  // short-lived resources (upload staging): bump allocation, the space comes back when the whole block is freed
+};
+
+// Block sub-allocator: one pool of blocks per memory type, so that buffers and images share a few vkAllocateMemory calls
+// (the device may limit them to maxMemoryAllocationCount). Host-visible blocks are mapped once, for their whole life.
+// Requests larger than half a block get a dedicated block.
+class DeviceMemoryAllocator {
+public:
+    void init(VkPhysicalDevice physicalDevice, VkDevice logicalDevice) {
+        device = logicalDevice;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        bufferImageGranularity = properties.limits.bufferImageGranularity;
+        pools.resize(memoryProperties.memoryTypeCount);
+    }
+
+    MemoryAllocation allocate(const VkMemoryRequirements& requirements, uint32_t memoryType, AllocationStrategy strategy) {
+        // buffers and optimal-tiling images may share a block, keep them bufferImageGranularity apart
+        VkDeviceSize alignment = std::max(requirements.alignment, bufferImageGranularity);
+        VkDeviceSize blockSize = poolBlockSize(memoryType);
+
+        MemoryAllocation allocation;
+        allocation.memoryType = memoryType;
+        allocation.requestedSize = requirements.size;
+
+        std::vector<MemoryBlock>& pool = pools[memoryType];
+        if (requirements.size > blockSize / 2) {
+            allocation.block = createBlock(memoryType, requirements.size, strategy, true);
+            allocation.size = requirements.size;
+            pool[allocation.block].usedBytes = allocation.size;
+            pool[allocation.block].liveAllocations = 1;
+        } else {
+            bool placed = false;
+            for (uint32_t i = 0; i < pool.size() && !placed; i++) {
+                if (pool[i].memory != VK_NULL_HANDLE && !pool[i].dedicated && pool[i].strategy == strategy) {
+                    placed = allocateFromBlock(pool[i], requirements.size, alignment, allocation);
+                    allocation.block = i;
+                }
+            }
+            if (!placed) {
+                allocation.block = createBlock(memoryType, blockSize, strategy, false);
+                if (!allocateFromBlock(pool[allocation.block], requirements.size, alignment, allocation)) {
+                    throw std::runtime_error("failed to sub-allocate memory!");
+                }
+            }
+        }
+
+        MemoryBlock& block = pool[allocation.block];
+        allocation.memory = block.memory;
+        allocation.mapped = block.mapped ? static_cast<uint8_t*>(block.mapped) + allocation.offset : nullptr;
+        block.requestedBytes += allocation.requestedSize;
+        return allocation;
+    }
+
+    void free(MemoryAllocation& allocation) {
+        if (allocation.memory == VK_NULL_HANDLE) {
+            return;
+        }
+        MemoryBlock& block = pools[allocation.memoryType][allocation.block];
+        block.usedBytes -= allocation.size;
+        block.requestedBytes -= allocation.requestedSize;
+        block.liveAllocations--;
+        if (block.liveAllocations == 0) {
+            destroyBlock(block); // empty blocks go back to the device (e.g. the staging block once the init uploads are done)
+        } else if (block.strategy == ALLOCATION_BUDDY) {
+            // merging with the buddy as long as it is free as well
+            VkDeviceSize offset = allocation.offset;
+            uint32_t order = buddyOrder(allocation.size);
+            while (order < block.freeLists.size() - 1) {
+                VkDeviceSize buddy = offset ^ (MIN_BUDDY_SIZE << order);
+                auto& freeList = block.freeLists[order];
+                auto it = std::find(freeList.begin(), freeList.end(), buddy);
+                if (it == freeList.end()) {
+                    break;
+                }
+                freeList.erase(it);
+                offset = std::min(offset, buddy);
+                order++;
+            }
+            block.freeLists[order].push_back(offset);
+        }
+        allocation = MemoryAllocation();
+    }
+
+    void destroy() {
+        for (auto& pool : pools) {
+            for (auto& block : pool) {
+                if (block.memory != VK_NULL_HANDLE) {
+                    destroyBlock(block);
+                }
+            }
+        }
+        pools.clear();
+    }
+
+    // Bytes reserved from and used in every heap, with the padding added by the strategies
+    // and the fragmentation of the free space (1 - largest free range of each block / free bytes)
+    void report() const {
+        for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; heap++) {
+            uint32_t blocks = 0;
+            VkDeviceSize reserved = 0, used = 0, requested = 0, freeBytes = 0, largestFree = 0; // largestFree summed over blocks
+            for (uint32_t type = 0; type < pools.size(); type++) {
+                if (memoryProperties.memoryTypes[type].heapIndex != heap) {
+                    continue;
+                }
+                for (const auto& block : pools[type]) {
+                    if (block.memory == VK_NULL_HANDLE) {
+                        continue;
+                    }
+                    blocks++;
+                    reserved += block.size;
+                    used += block.usedBytes;
+                    requested += block.requestedBytes;
+                    if (!block.dedicated) {
+                        freeBytes += block.size - block.usedBytes;
+                        largestFree += largestFreeRange(block);
+                    }
+                }
+            }
+            if (blocks == 0) {
+                continue;
+            }
+            bool deviceLocal = (memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+            std::cout << "memory heap " << heap << (deviceLocal ? " (device local): " : " (host): ") << blocks << " blocks, "
+                      << reserved / 1048576.0 << " MiB reserved, " << requested / 1048576.0 << " MiB used, "
+                      << (used - requested) / 1048576.0 << " MiB padding";
+            if (freeBytes > 0) {
+                std::cout << ", " << 100.0 * (1.0 - double(largestFree) / freeBytes) << "% fragmented";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+private:
+    // smallest buddy range, and default block size (smaller on small heaps)
+    static const VkDeviceSize MIN_BUDDY_SIZE = 256;
+    static const VkDeviceSize MAX_BLOCK_SIZE = 64ull << 20;
+
+    struct MemoryBlock {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;
+        AllocationStrategy strategy = ALLOCATION_BUDDY;
+        bool dedicated = false;
+        uint32_t liveAllocations = 0;
+        VkDeviceSize usedBytes = 0;
+        VkDeviceSize requestedBytes = 0;
+        VkDeviceSize head = 0;                             // linear: first free byte
+        std::vector<std::vector<VkDeviceSize>> freeLists;  // buddy: free range offsets, per order (MIN_BUDDY_SIZE << order bytes)
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties = {};
+    VkDeviceSize bufferImageGranularity = 1;
+    std::vector<std::vector<MemoryBlock>> pools;
+
+    static uint32_t buddyOrder(VkDeviceSize size) {
+        uint32_t order = 0;
+        while ((MIN_BUDDY_SIZE << order) < size) {
+            order++;
+        }
+        return order;
+    }
+
+    // power of two, so that buddy ranges stay aligned to their size
+    VkDeviceSize poolBlockSize(uint32_t memoryType) const {
+        VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+        VkDeviceSize blockSize = MAX_BLOCK_SIZE;
+        while (blockSize > MIN_BUDDY_SIZE && blockSize > heapSize / 8) {
+            blockSize /= 2;
+        }
+        return blockSize;
+    }
+
+    uint32_t createBlock(uint32_t memoryType, VkDeviceSize size, AllocationStrategy strategy, bool dedicated) {
+        MemoryBlock block;
+        block.size = size;
+        block.strategy = strategy;
+        block.dedicated = dedicated;
+        if (!dedicated && strategy == ALLOCATION_BUDDY) {
+            block.freeLists.resize(buddyOrder(size) + 1);
+            block.freeLists.back().push_back(0);
+        }
+
+        VkMemoryAllocateInfo memAllocInfo = {};
+        memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memAllocInfo.allocationSize = size;
+        memAllocInfo.memoryTypeIndex = memoryType;
+
+        std::cout << "...allocating memory block (" << size << " bytes, type " << memoryType << ")..." << std::endl;
+        VkResult res = vkAllocateMemory(device, &memAllocInfo, nullptr, &block.memory);
+        if (res != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate memory!");
+        }
+        if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped);
+        }
+
+        // reusing the slot of a destroyed dedicated block, so that allocation.block indices stay valid
+        std::vector<MemoryBlock>& pool = pools[memoryType];
+        for (uint32_t i = 0; i < pool.size(); i++) {
+            if (pool[i].memory == VK_NULL_HANDLE) {
+                pool[i] = std::move(block);
+                return i;
+            }
+        }
+        pool.push_back(std::move(block));
+        return static_cast<uint32_t>(pool.size() - 1);
+    }
+
+    void destroyBlock(MemoryBlock& block) {
+        if (block.mapped) {
+            vkUnmapMemory(device, block.memory);
+        }
+        vkFreeMemory(device, block.memory, nullptr);
+        block = MemoryBlock();
+    }
+
+    bool allocateFromBlock(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, MemoryAllocation& allocation) {
+        if (block.strategy == ALLOCATION_LINEAR) {
+            VkDeviceSize offset = (block.head + alignment - 1) / alignment * alignment;
+            if (offset + size > block.size) {
+                return false;
+            }
+            allocation.offset = offset;
+            allocation.size = offset + size - block.head; // alignment padding counts as used until the block is released
+            block.head = offset + size;
+        } else {
+            uint32_t order = buddyOrder(std::max(size, alignment));
+            uint32_t freeOrder = order;
+            while (freeOrder < block.freeLists.size() && block.freeLists[freeOrder].empty()) {
+                freeOrder++;
+            }
+            if (freeOrder >= block.freeLists.size()) {
+                return false;
+            }
+            VkDeviceSize offset = block.freeLists[freeOrder].back();
+            block.freeLists[freeOrder].pop_back();
+            // splitting down to the requested order, the upper halves become free buddies
+            while (freeOrder > order) {
+                freeOrder--;
+                block.freeLists[freeOrder].push_back(offset + (MIN_BUDDY_SIZE << freeOrder));
+            }
+            allocation.offset = offset;
+            allocation.size = MIN_BUDDY_SIZE << order;
+        }
+        block.usedBytes += allocation.size;
+        block.liveAllocations++;
+        return true;
+    }
+
+    static VkDeviceSize largestFreeRange(const MemoryBlock& block) {
+        if (block.strategy == ALLOCATION_LINEAR) {
+            return block.size - block.head;
+        }
+        for (size_t order = block.freeLists.size(); order > 0; order--) {
+            if (!block.freeLists[order - 1].empty()) {
+                return MIN_BUDDY_SIZE << (order - 1);
+            }
+        }
+        return 0;
+    }
+};
+
+// Persistently mapped staging buffer of one frame in flight: uploads take aligned slices from head,
+// which goes back to 0 once the frame's fence has signalled
+struct StagingRing {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    MemoryAllocation memory;
+    VkDeviceSize size = 0;
+    VkDeviceSize head = 0;
+};
+
+struct StagingSlice {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    uint8_t* data;
+};
+
+struct SwapChainSupportDetails {
+    VkSurfaceCapabilitiesKHR surfaceCapabilities;
+    std::vector<VkSurfaceFormatKHR> formats;
+    std::vector<VkPresentModeKHR> presentModes;
+};
+
+struct Vertex {
+    glm::vec2 pos;
+    glm::vec3 color;
+    glm::vec2 texCoord;
+    glm::vec3 warp; // u, v, intensity of the warp map at texCoord (--mesh-warp only)
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescr = {};
+        bindingDescr.binding = 0;
+        bindingDescr.stride = sizeof(Vertex);
+        bindingDescr.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescr;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 4> attrDesrc = {};
+        
+        attrDesrc[0].binding = 0;
+        attrDesrc[0].location = 0;
+        attrDesrc[0].format = VK_FORMAT_R32G32_SFLOAT;
+        attrDesrc[0].offset = offsetof(Vertex, pos);
+
+        attrDesrc[1].binding = 0;
+        attrDesrc[1].location = 1;
+        attrDesrc[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attrDesrc[1].offset = offsetof(Vertex, color);
+
+        attrDesrc[2].binding = 0;
+        attrDesrc[2].location = 2;
+        attrDesrc[2].format = VK_FORMAT_R32G32_SFLOAT;
+        attrDesrc[2].offset = offsetof(Vertex, texCoord);
+
+        attrDesrc[3].binding = 0;
+        attrDesrc[3].location = 3;
+        attrDesrc[3].format = VK_FORMAT_R32G32B32_SFLOAT;
+        attrDesrc[3].offset = offsetof(Vertex, warp);
+
+        return attrDesrc;
+    } 
+};
+
+struct UniformBufferObject {
+    alignas(16) glm::mat4 model;
+    alignas(16) glm::mat4 view;
+    alignas(16) glm::mat4 proj;
+};
+
+// ###VERTICES INFORMATION###
+const std::vector<Vertex> verticesQuad = {
+    {{-0.5625f, -1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
+    {{ 0.5625f, -1.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
+    {{ 0.5625f,  1.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
+    {{-0.5625f,  1.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}}
+};
+
+const std::vector<Vertex> verticesFull = {
+    {{-1.0f, -1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
+    {{ 1.0f, -1.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
+    {{ 1.0f,  1.0f}, {0.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
+    {{-1.0f,  1.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}}
+};
+
+const std::vector<uint16_t> indices = {
+    0, 1, 2, 2, 3, 0
+};
+
+// Triangle mesh drawn instead of the quad with --mesh-warp: u, v and intensity are vertex attributes, interpolated
+// across the triangles, so the fragment shader only samples the color texture
+struct WarpMesh {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+};
+
+// Right-triangulated irregular network fitted to the warp map (the terrain meshing of "Martini"). The warp map is sampled
+// like the warp sampler (bilinear, clamped) on a grid of 2^k + 1 points per side, at least one per texel. Starting from
+// the two halves of the quad, a right triangle is split at the midpoint of its hypotenuse while the linear interpolation
+// there is off by more than maxError. The error of a midpoint includes those of the midpoints below it and is shared by
+// the triangles on either side of the hypotenuse, so that neighbours split together and the mesh has no T-junctions.
+// Errors are in color texture pixels for u and v; an intensity error of 1/255 counts as maxError. Across discontinuities
+// of the map (the rim of the dome disc) the grid cells are refined down to one texel, and no further. Triangles with a zero
+// intensity at their three vertices are dropped when cullBlack is set (they would be drawn black over the black clear).
+static WarpMesh buildWarpMesh(const std::vector<uint16_t>& uvi, uint32_t width, uint32_t height, glm::vec2 quadMin, glm::vec2 quadMax,
+                              uint32_t colorWidth, uint32_t colorHeight, float maxError, bool cullBlack) {
+    int32_t tile = 1;
+    while (tile < static_cast<int32_t>(std::max(width, height))) {
+        tile *= 2;
+    }
+    int32_t size = tile + 1;
+
+    // grid values, 16-bit like the warp map. Texel centres are at (i + 0.5) / width, clamped at the borders.
+    auto taps = [](int32_t gridSize, uint32_t texels, std::vector<uint32_t>& first, std::vector<uint32_t>& second, std::vector<float>& weight) {
+        for (int32_t g = 0; g < gridSize; g++) {
+            float position = std::min(std::max(float(g) / (gridSize - 1) * texels - 0.5f, 0.0f), float(texels - 1));
+            first.push_back(static_cast<uint32_t>(position));
+            second.push_back(std::min(first.back() + 1, texels - 1));
+            weight.push_back(position - first.back());
+        }
+    };
+    std::vector<uint32_t> x0, x1, y0, y1;
+    std::vector<float> wx, wy;
+    taps(size, width, x0, x1, wx);
+    taps(size, height, y0, y1, wy);
+    std::vector<uint16_t> values(3 * size_t(size) * size);
+    for (int32_t gy = 0; gy < size; gy++) {
+        const uint16_t* row0 = &uvi[3 * size_t(y0[gy]) * width];
+        const uint16_t* row1 = &uvi[3 * size_t(y1[gy]) * width];
+        for (int32_t gx = 0; gx < size; gx++) {
+            for (int c = 0; c < 3; c++) {
+                float top = row0[3 * x0[gx] + c] + (row0[3 * x1[gx] + c] - row0[3 * x0[gx] + c]) * wx[gx];
+                float bottom = row1[3 * x0[gx] + c] + (row1[3 * x1[gx] + c] - row1[3 * x0[gx] + c]) * wx[gx];
+                values[3 * (size_t(gy) * size + gx) + c] = static_cast<uint16_t>(top + (bottom - top) * wy[gy] + 0.5f);
+            }
+        }
+    }
+
+    // Midpoint errors, finest level first. Midpoints of axis-aligned hypotenuses of half length s ("A", one coordinate an
+    // odd multiple of s, the other a multiple of 2s) depend on the four diagonal ones at s / 2; midpoints of diagonal
+    // hypotenuses ("B", both coordinates odd multiples of s) on the four axis-aligned ones at s. A diagonal hypotenuse runs
+    // between the two corners whose coordinates sum to an even multiple of 2s.
+    const float weights[3] = {colorWidth / 65535.0f, colorHeight / 65535.0f, 255.0f * maxError / 65535.0f};
+    auto index = [size](int32_t x, int32_t y) { return size_t(y) * size + x; };
+    auto interpolationError = [&](size_t a, size_t b, size_t m) {
+        float error = 0.0f;
+        for (int c = 0; c < 3; c++) {
+            float interpolated = 0.5f * (float(values[3 * a + c]) + float(values[3 * b + c]));
+            error = std::max(error, std::abs(interpolated - values[3 * m + c]) * weights[c]);
+        }
+        return error;
+    };
+    std::vector<float> errors(size_t(size) * size, 0.0f);
+    auto childError = [&](int32_t x, int32_t y) {
+        return (x >= 0 && y >= 0 && x < size && y < size) ? errors[index(x, y)] : 0.0f;
+    };
+    for (int32_t s = 1; s < tile; s *= 2) {
+        // A(s): hypotenuse along the axis of the odd coordinate
+        for (int32_t y = 0; y < size; y += s) {
+            for (int32_t x = (y / s) % 2 == 0 ? s : 0; x < size; x += 2 * s) {
+                bool alongX = (x / s) % 2 == 1;
+                size_t a = alongX ? index(x - s, y) : index(x, y - s);
+                size_t b = alongX ? index(x + s, y) : index(x, y + s);
+                float error = interpolationError(a, b, index(x, y));
+                if (s >= 2) {
+                    int32_t h = s / 2;
+                    error = std::max({error, childError(x - h, y - h), childError(x + h, y - h), childError(x - h, y + h), childError(x + h, y + h)});
+                }
+                errors[index(x, y)] = error;
+            }
+        }
+        // B(s)
+        for (int32_t y = s; y < size; y += 2 * s) {
+            for (int32_t x = s; x < size; x += 2 * s) {
+                bool diagonal = ((x - s + y - s) / (2 * s)) % 2 == 0; // (x - s, y - s) is an end of the hypotenuse
+                size_t a = diagonal ? index(x - s, y - s) : index(x + s, y - s);
+                size_t b = diagonal ? index(x + s, y + s) : index(x - s, y + s);
+                errors[index(x, y)] = std::max({interpolationError(a, b, index(x, y)), childError(x - s, y), childError(x + s, y),
+                                                childError(x, y - s), childError(x, y + s)});
+            }
+        }
+    }
+
+    // Extraction: a triangle (a, b hypotenuse, c right angle) is split while its legs are longer than one cell and the
+    // error at its midpoint is too large
+    WarpMesh mesh;
+    std::vector<uint32_t> vertexOf(size_t(size) * size, std::numeric_limits<uint32_t>::max());
+    auto vertex = [&](int32_t x, int32_t y) {
+        size_t i = index(x, y);
+        if (vertexOf[i] == std::numeric_limits<uint32_t>::max()) {
+            vertexOf[i] = static_cast<uint32_t>(mesh.vertices.size());
+            glm::vec2 texCoord = {float(x) / tile, float(y) / tile};
+            glm::vec3 warp = {values[3 * i] / 65535.0f, values[3 * i + 1] / 65535.0f, values[3 * i + 2] / 65535.0f};
+            mesh.vertices.push_back({quadMin + texCoord * (quadMax - quadMin), {1.0f, 1.0f, 1.0f}, texCoord, warp});
+        }
+        return vertexOf[i];
+    };
+    std::vector<std::array<int32_t, 6>> pending = {{0, 0, tile, tile, tile, 0}, {tile, tile, 0, 0, 0, tile}};
+    while (!pending.empty()) {
+        std::array<int32_t, 6> t = pending.back();
+        pending.pop_back();
+        int32_t ax = t[0], ay = t[1], bx = t[2], by = t[3], cx = t[4], cy = t[5];
+        int32_t mx = (ax + bx) / 2, my = (ay + by) / 2;
+        if (std::abs(ax - cx) + std::abs(ay - cy) > 1 && errors[index(mx, my)] > maxError) {
+            pending.push_back({cx, cy, ax, ay, mx, my});
+            pending.push_back({bx, by, cx, cy, mx, my});
+            continue;
+        }
+        if (cullBlack && values[3 * index(ax, ay) + 2] == 0 && values[3 * index(bx, by) + 2] == 0 && values[3 * index(cx, cy) + 2] == 0) {
+            continue;
+        }
+        // same winding as the quad: clockwise on screen (y down), a positive cross product in grid coordinates
+        bool counterclockwise = int64_t(bx - ax) * (cy - ay) - int64_t(by - ay) * (cx - ax) > 0;
+        uint32_t va = vertex(ax, ay), vb = vertex(bx, by), vc = vertex(cx, cy);
+        mesh.indices.insert(mesh.indices.end(), {va, counterclockwise ? vb : vc, counterclockwise ? vc : vb});
+    }
+    return mesh;
+}
+
+class VkWarpApp {
+private:
+    GLFWwindow* window;
+    
+    // for real-time screen capturing
+    #if __linux__
+        Display *display;
+        Window root_window;
+        XImage *screenCapture = nullptr; // front slot image (owned by the render thread)
+        bool shmCapture = false;
+        std::vector<CaptureSlot> captureSlots;
+    #endif
+    TripleBuffer captureFrames;
+    CaptureStats captureStats;
+    // capture slots imported as Vulkan buffers (one per slot), used as copy source instead of the staging ring
+    bool hostMemoryImport = false;
+    bool hostMemoryImportInstanceExtensions = false; // enabled on the instance by getRequiredExtensions
+    VkDeviceSize hostPointerAlignment = 0;
+    std::vector<VkBuffer> captureImportBuffers;
+    std::vector<VkDeviceMemory> captureImportBuffersMemory;
+    std::thread captureThread;
+    std::atomic<bool> captureRunning{false};
+    VkInstance instance = 0;
+    VkDebugUtilsMessengerEXT debugMessenger;
+    VkSurfaceKHR surface;
+    
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice logicalDevice;
+    
+    VkQueue graphicsQueue;
+    VkQueue presentQueue;
+    VkQueue transferQueue;
+    QueueFamilyIndices deviceQueueFamilies;
+    bool transferQueueDedicated = false; // captures and warp reloads are uploaded on transferQueue and handed over to graphicsQueue
+    
+    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+    std::vector<VkImage> swapChainImages;
+    VkFormat swapChainImageFormat;
+    VkExtent2D swapChainExtent;
+    std::vector<VkImageView> swapChainImageViews;
+    std::vector<VkFramebuffer> swapChainFramebuffers;
+    // headless mode: offscreen targets stand in for the swap chain images (one per frame in flight), each one copied after
+    // its draw into a host-visible buffer
+    std::vector<MemoryAllocation> offscreenImagesMemory;
+    std::vector<VkBuffer> readbackBuffers;
+    std::vector<MemoryAllocation> readbackBuffersMemory;
+    bool validationFailed = false; // set by --validate, reported once everything is released
+    // batch mode (--batch): each frame goes through a slot, from its decode to its encode. A slot is reused once the
+    // encode of its previous frame has finished, so at most batchDepth frames are held in memory.
+    struct BatchSlot {
+        VkBuffer input = VK_NULL_HANDLE; // decoded frame (mapped), copied into the color texture
+        MemoryAllocation inputMemory;
+        VkBuffer output = VK_NULL_HANDLE; // warped frame read back (mapped)
+        MemoryAllocation outputMemory;
+        std::future<void> decode;
+        std::future<void> encode;
+        uint64_t submission = 0; // frame number of its draw
+    };
+    std::vector<std::string> batchFrames;
+    std::vector<BatchSlot> batchSlots;
+    BatchSlot* batchSlot = nullptr; // slot of the frame being drawn, if any
+    
+    VkRenderPass renderPass;
+    VkRenderPass renderPassLoad; // keeps the previous contents of the swap chain image, for partial redraws
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline graphicsPipeline;
+    VkPipelineCache pipelineCache;
+    // SPIR-V loaded once at startup, reused by every pipeline (re)creation
+    std::vector<uint32_t> vertShaderCode;
+    std::vector<uint32_t> fragShaderCode;
+    
+    VkCommandPool commandPool;
+    // init-time uploads are recorded into one command buffer and submitted once (see submitUploadBatch)
+    VkCommandBuffer uploadBatchCommandBuffer = VK_NULL_HANDLE;
+    std::vector<std::pair<VkBuffer, MemoryAllocation>> uploadBatchStagingBuffers;
+    DeviceMemoryAllocator memoryAllocator;
+    // per-frame upload commands, submitted in the same batch as the frame's draw commands
+    std::vector<VkCommandBuffer> uploadCommandBuffers;
+    VkCommandPool transferCommandPool;
+    std::vector<VkCommandBuffer> transferCommandBuffers;
+
+    // u, v and intensity of the MS/LS warp map pair recombined at load into 16-bit (or float) u, v and 8-bit intensities
+    WarpTexture warpTexture;
+    VkFormat warpTexFormat; // of the uv image
+    VkSampler warpSampler;
+
+    // one color texture and staging buffer per frame in flight, so that uploading a frame never touches what a previous one samples
+    std::vector<VkImage> colorTextureImages;
+    std::vector<MemoryAllocation> colorTextureImagesMemory;
+    std::vector<VkImageView> colorTextureImageViews;
+    std::vector<uint64_t> colorTextureSerials; // capture held by each color texture (compared with latestCaptureSerial)
+    std::vector<std::vector<uint32_t>> colorTextureTileHashes; // tile hashes of each color texture contents
+    std::vector<VkBufferImageCopy> dirtyTileRegions;
+    uint32_t colorTextureWidth = 0;
+    uint32_t colorTextureHeight = 0;
+
+    // warp map kept on the CPU (16-bit u, v, intensity per texel) to know which output tiles sample which capture tiles
+    std::vector<uint16_t> warpMap;
+    uint32_t warpMapWidth = 0;
+    uint32_t warpMapHeight = 0;
+    uint32_t warpMapLevels = 1; // mip levels of the warp texture (only .vwm files carry more than one)
+    std::vector<std::vector<uint32_t>> sourceTileOutputs; // for each capture tile, the output tiles that sample it
+    uint32_t outputTilesX = 0;
+    uint32_t outputTilesY = 0;
+    // output tiles to redraw in each swap chain image, accumulated since the image was last rendered
+    std::vector<std::vector<uint8_t>> outputTileDamage;
+    std::vector<uint32_t> outputTileDamageCount;
+    std::vector<uint32_t> displayedTileHashes; // tile hashes of the capture drawn by the last frame
+    uint64_t displayedCaptureSerial = 0;
+    std::vector<VkRect2D> damageScissors;
+    uint64_t latestCaptureSerial = 0;
+    VkFormat colorTexFormat;
+    std::array<StagingRing, MAX_FRAMES_IN_FLIGHT> stagingRings;
+    VkDeviceSize stagingAlignment = 16;
+    
+    VkSampler textureSampler;
+
+    const std::vector<Vertex>* quadVertices;
+    VkBuffer vertexBuffer;
+    MemoryAllocation vertexBufferMemory;
+    VkBuffer indexBuffer;
+    MemoryAllocation indexBufferMemory;
+    uint32_t drawIndexCount = 0; // indices of the draw mesh (buildDrawMesh)
+    VkIndexType drawIndexType = VK_INDEX_TYPE_UINT16;
+
+    std::vector<VkBuffer> uniformBuffers;
+    std::vector<MemoryAllocation> uniformBuffersMemory;
+
+    VkDescriptorPool descriptorPool;
+    std::vector<VkDescriptorSet> descriptorSets;
+    std::array<VkWriteDescriptorSet, 4> writeDescriptorSets = {};
+    VkDescriptorImageInfo descriptorColorImageInfo = {};
+    
+    std::vector<VkCommandBuffer> commandBuffers; // one per frame in flight, re-recorded every frame
+    
+    std::vector<VkSemaphore> imgAvailSemaphores;
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+    std::vector<VkFence> inFlightFences;
+    std::vector<VkSemaphore> uploadCompleteSemaphores; // transfer queue -> graphics queue hand-off
+    size_t currentFrame = 0;
+    // frames are numbered from 1 as they are submitted, to know when retired objects are no longer in use
+    uint64_t submittedFrames = 0;
+    std::array<uint64_t, MAX_FRAMES_IN_FLIGHT> frameSubmissions = {}; // last frame submitted with each in-flight fence
+    std::vector<DeferredDeletion> deletionQueue;
+
+    VkWarpOptions options;
+    TextureCache textureCache; // declared before the worker pool, whose jobs use it
+    // image files are decoded on the worker pool while the Vulkan objects are created
+    WorkerPool workerPool{std::max(2u, std::thread::hardware_concurrency())};
+    std::future<DecodedImage> uvMSDecode;
+    std::future<DecodedImage> uvLSDecode;
+    std::future<EncodedImage> colorFileRead;
+    std::future<void> colorDecode; // into colorDecodeStaging
+
+    // warp map hot reload (--watch-warp-map): the files are watched with inotify, decoded on the worker pool and uploaded
+    // on the transfer queue into a second image, which the descriptor sets switch to at a frame boundary
+    enum WarpReloadState { WARP_RELOAD_IDLE, WARP_RELOAD_DECODING, WARP_RELOAD_COPYING, WARP_RELOAD_UPLOADING };
+    WarpReloadState warpReloadState = WARP_RELOAD_IDLE;
+    std::string uvMSFile;
+    std::string uvLSFile;
+    int warpWatchFd = -1;
+    std::vector<std::pair<int, std::string>> warpWatches; // inotify watch descriptor of a directory, watched file name in it
+    bool warpChangePending = false;
+    std::chrono::steady_clock::time_point warpChangeTime; // last change, the reload starts once the writes have settled
+    std::future<std::shared_ptr<WarpMapUpdate>> warpReloadDecode;
+    std::future<void> warpReloadCopy;
+    std::shared_ptr<WarpMapUpdate> warpReload;
+    std::shared_ptr<WarpMesh> warpReloadMesh; // --mesh-warp: fitted to the new map on the worker pool along with the copy
+    VkRect2D warpReloadDifference; // texels changed with respect to the displayed warp map
+    std::vector<VkBufferImageCopy> warpReloadRegions;          // uv image
+    std::vector<VkBufferImageCopy> warpReloadIntensityRegions; // intensity image
+    VkBuffer warpReloadStagingBuffer = VK_NULL_HANDLE;
+    MemoryAllocation warpReloadStagingMemory;
+    VkCommandBuffer warpReloadCommandBuffer = VK_NULL_HANDLE;
+    VkFence warpReloadFence = VK_NULL_HANDLE;
+    VkSemaphore warpReloadSemaphore = VK_NULL_HANDLE; // waited by the frame switching to the new warp map
+    bool waitForWarpReload = false;
+    bool warpReloadInPlace = false;
+    // images being uploaded: the spare ones (updated in place) or new ones
+    WarpTexture warpReloadTexture;
+    // previously displayed warp map, kept to receive the next reload: only the texels differing from the new map are uploaded
+    WarpTexture spareWarpTexture;
+    VkFormat spareWarpFormat = VK_FORMAT_UNDEFINED;
+    uint32_t spareWarpWidth = 0;
+    uint32_t spareWarpHeight = 0;
+    uint32_t spareWarpLevels = 0;
+    uint64_t spareWarpLastUse = 0; // last frame sampling it
+    VkRect2D spareWarpDifference; // texels differing from the displayed warp map
+    std::array<bool, MAX_FRAMES_IN_FLIGHT> warpDescriptorStale = {}; // descriptor set still pointing at the previous warp map
+    StagingSlice colorDecodeStaging;
+    uint64_t decodeWaitMicros = 0;
+    std::chrono::steady_clock::time_point runStartTime;
+    bool firstFramePresented = false;
+    bool framebufferResized = false;
+    bool capture = false;
+    time_t globalStartTime;
+    int frameNumber = 0;
+    int warpType;
+    //const char* idMS = "texture/identityUVMS.png";
+    //const char* idLS = "texture/identityUVLS.png";
+    //const char* swMS = "texture/SimpleWarpUVMS.png";
+    //const char* swLS = "texture/SimpleWarpUVLS.png";
+    //const char* swiMS = "texture/SimpleWarpUVIdentityMS.png";
+    //const char* swiLS = "texture/SimpleWarpUVIdentityLS.png";
+    //const char* warpMS = "texture/WarpUVMS.png";
+    //const char* warpLS = "texture/WarpUVLS.png";
+
+
+    // Initialising GLFW instance, attributes and creating window
+    void initWindow() {
+        #if __linux__
+            XInitThreads(); // the display connection is handed over to the capture thread
+            display = XOpenDisplay(nullptr);
+            root_window = DefaultRootWindow(display);
+            if (capture) {
+                initScreenCapture();
+            }
+        #endif
+
+        glfwInit();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+        window = glfwCreateWindow(WIDTH, HEIGHT, "vkWarp", nullptr, nullptr);
+        glfwSetWindowUserPointer(window, this);
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    }
 
-        vkFreeCommandBuffers(logicalDevice, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-
-        vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
-        std::cout << "Graphics Pipeline Destroyed" << std::endl;
-        vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
-        std::cout << "Pipeline Layout Destroyed" << std::endl;
-        vkDestroyRenderPass(logicalDevice ,renderPass, nullptr);
-        std::cout << "Render Pass Destroyed" << std::endl;
+    static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
+        auto app = reinterpret_cast<VkWarpApp*>(glfwGetWindowUserPointer(window));
+        app->framebufferResized = true;
+    }
+
+    void initVulkan(bool fullscreen) {
+        createInstance();
+        std::cout << "Instance Created" << std::endl;
+        setupDebugCallback();
+        std::cout << "Debug Callback Setup Successful" << std::endl;
+        if (!options.headless) {
+            createSurface();
+            std::cout << "Surface Created" << std::endl;
+        }
+        pickPhysicalDevice();
+        std::cout << "Physical Device Picked" << std::endl;
+        createLogicalDevice();
+        std::cout << "Logical Device Created" << std::endl;
+        memoryAllocator.init(physicalDevice, logicalDevice);
+        createStagingRings();
+        std::cout << "Staging Rings Created" << std::endl;
+        startColorDecode();
+        if (options.headless) {
+            createOffscreenTargets();
+            std::cout << "Offscreen Targets Created" << std::endl;
+        } else {
+            createSwapChain();
+            std::cout << "Swap Chain Created" << std::endl;
+        }
+        createImageViews();
+        std::cout << "Image Views Created" << std::endl;
+        createRenderPass();
+        std::cout << "Render Pass Created" << std::endl;
+        createDescriptorSetLayout();
+        std::cout << "Descriptor Set Layout Created" << std::endl;
+        createPipelineCache();
+        std::cout << "Pipeline Cache Created" << std::endl;
+        createGraphicsPipeline();
+        std::cout << "Graphics Pipeline Created" << std::endl;
+        createFramebuffers();
+        std::cout << "Framebuffers Created" << std::endl;
+        createCommandPool();
+        std::cout << "Command Pool Created" << std::endl;
+        beginUploadBatch();
+        createTextureImage();
+        std::cout << "Texture Image Created" << std::endl;
+        if (capture && options.importHostMemory) {
+            importCaptureMemory();
+        }
+        createTextureImageView();
+        std::cout << "Texture Image View Created" << std::endl;
+        createTextureSampler();
+        std::cout << "Texture Image Sampler" << std::endl;
+        quadVertices = fullscreen ? &verticesFull : &verticesQuad;
+        std::vector<Vertex> meshVertices;
+        std::vector<uint32_t> meshIndices;
+        buildDrawMesh(meshVertices, meshIndices);
+        createVertexBuffer(meshVertices);
+        std::cout << "Vertex Buffer Created" << std::endl;
+        createIndexBuffer(meshIndices, meshVertices.size());
+        std::cout << "Index Buffer Created" << std::endl;
+        submitUploadBatch();
+        std::cout << "Uploads Submitted" << std::endl;
+        buildTileDependencyIndex();
+        std::cout << "Tile Dependency Index Built" << std::endl;
+        createUniformBuffer();
+        std::cout << "Uniform Buffer Created" << std::endl;
+        createDescriptorPool();
+        std::cout << "Descriptor Pool Created" << std::endl;
+        createDescriptorSets();
+        std::cout << "Descriptor Sets Created" << std::endl;
+        createCommandBuffers();
+        std::cout << "Command Buffers Created" << std::endl;
+        createUploadCommandBuffers();
+        std::cout << "Upload Command Buffers Created" << std::endl;
+        createSyncObjs();
+        std::cout << "Semaphores Created" << std::endl;
+        memoryAllocator.report();
+        std::cout << "initialisation blocked " << decodeWaitMicros / 1000.0 << " ms on image decodes" << std::endl;
+        textureCache.report();
+    }
+
+    void mainLoop() {
+       time(&globalStartTime);
+
+        if (options.headless) {
+            if (!batchFrames.empty()) {
+                renderBatch();
+            } else {
+                renderHeadless();
+            }
+            return;
+        }
+
+        if (capture) {
+            startCaptureThread();
+        }
+
+        while (!glfwWindowShouldClose(window)) {
+            glfwPollEvents();
+            drawFrame();
+        }
+
+        stopCaptureThread();
+        
+        vkDeviceWaitIdle(logicalDevice);
+    }
+
+    // Headless main loop: options.frames frames rendered back to back (two in flight, nothing presented), the last one written
+    // to options.outputFile
+    void renderHeadless() {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < options.frames; i++) {
+            drawFrame();
+        }
+        size_t lastFrame = (currentFrame + MAX_FRAMES_IN_FLIGHT - 1) % MAX_FRAMES_IN_FLIGHT;
+        vkWaitForFences(logicalDevice, 1, &inFlightFences[lastFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << options.frames << " frames rendered in " << micros / 1000.0 << " ms ("
+                  << options.frames * 1e6 / std::max<int64_t>(micros, 1) << " fps, "
+                  << swapChainExtent.width << "x" << swapChainExtent.height << ")" << std::endl;
+
+        if (!options.outputFile.empty()) {
+            writeReadback(lastFrame, options.outputFile);
+            std::cout << "Output written to " << options.outputFile << std::endl;
+        }
+        if (options.validate) {
+            validationFailed = !validateWithCpuWarp(lastFrame);
+        }
+
+        vkDeviceWaitIdle(logicalDevice);
+    }
+
+    // Batch main loop, a pipeline over batchSlots: frames are decoded on the worker pool into the slots' mapped input buffers
+    // ahead of their draw, drawn two at a time like any headless frame (upload, warp and readback in one submission) and
+    // encoded on the worker pool once their fence has signalled. The main thread only blocks when the next frame is not
+    // decoded yet, or when its slot still holds a frame being encoded.
+    void renderBatch() {
+        createBatchSlots();
+        std::filesystem::create_directories(options.batchOutputDir);
+        auto start = std::chrono::steady_clock::now();
+        uint64_t decodeWait = 0, encodeWait = 0; // microseconds the main thread spent blocked
+
+        size_t frameCount = batchFrames.size();
+        size_t slotCount = batchSlots.size();
+        size_t decoded = 0; // frames whose decode has been started
+        size_t encoded = 0; // frames whose encode has been started (in order)
+        std::deque<size_t> drawn; // frames submitted, not yet handed to the encoder
+        auto slotFree = [&](size_t frame) {
+            // the previous frame of the slot has been drawn and encoded
+            const BatchSlot& slot = batchSlots[frame % slotCount];
+            return frame < encoded + slotCount && (!slot.encode.valid() || isReady(slot.encode));
+        };
+        for (size_t frame = 0; frame < frameCount; frame++) {
+            // decoding ahead into every free slot. The draw of frame - 1 waited for frame - 1 - MAX_FRAMES_IN_FLIGHT, so with
+            // batchDepth > MAX_FRAMES_IN_FLIGHT the encode of a slot's previous frame has always been started by the time
+            // the slot is needed for the next frame to draw, and waiting for it is enough.
+            while (decoded < frameCount && slotFree(decoded)) {
+                startBatchDecode(decoded++);
+            }
+            if (decoded == frame) {
+                auto waitStart = std::chrono::steady_clock::now();
+                if (batchSlots[frame % slotCount].encode.valid()) {
+                    batchSlots[frame % slotCount].encode.get();
+                }
+                encodeWait += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - waitStart).count();
+                startBatchDecode(decoded++);
+            }
+
+            BatchSlot& slot = batchSlots[frame % slotCount];
+            auto waitStart = std::chrono::steady_clock::now();
+            slot.decode.get(); // rethrows a decode failure
+            decodeWait += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - waitStart).count();
+
+            batchSlot = &slot;
+            drawFrame();
+            batchSlot = nullptr;
+            slot.submission = submittedFrames;
+            drawn.push_back(frame);
+
+            while (!drawn.empty() && frameCompleted(batchSlots[drawn.front() % slotCount].submission)) {
+                startBatchEncode(drawn.front());
+                drawn.pop_front();
+                encoded++;
+            }
+        }
+
+        vkDeviceWaitIdle(logicalDevice);
+        for (size_t frame : drawn) {
+            startBatchEncode(frame);
+        }
+        for (auto& slot : batchSlots) {
+            if (slot.encode.valid()) {
+                slot.encode.get();
+            }
+        }
+
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << frameCount << " frames warped in " << micros / 1e6 << " s (" << frameCount * 1e6 / std::max<int64_t>(micros, 1)
+                  << " fps), blocked " << decodeWait / 1000.0 << " ms on decodes and " << encodeWait / 1000.0 << " ms on encodes" << std::endl;
+        destroyBatchSlots();
+    }
+
+    void createBatchSlots() {
+        VkDeviceSize inputSize = VkDeviceSize(colorTextureWidth) * colorTextureHeight * 4;
+        VkDeviceSize outputSize = VkDeviceSize(swapChainExtent.width) * swapChainExtent.height * 4;
+        VkMemoryPropertyFlags outputProperties = readbackMemoryProperties();
+        batchSlots = std::vector<BatchSlot>(std::min<size_t>(options.batchDepth, batchFrames.size()));
+        for (auto& slot : batchSlots) {
+            createBuffer(inputSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         slot.input, slot.inputMemory);
+            createBuffer(outputSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, outputProperties, slot.output, slot.outputMemory);
+        }
+        std::cout << "batch pipeline: " << batchSlots.size() << " slots, " << (inputSize + outputSize) * batchSlots.size() / (1 << 20)
+                  << " MiB of frame buffers" << std::endl;
+    }
+
+    void destroyBatchSlots() {
+        for (auto& slot : batchSlots) {
+            vkDestroyBuffer(logicalDevice, slot.input, nullptr);
+            memoryAllocator.free(slot.inputMemory);
+            vkDestroyBuffer(logicalDevice, slot.output, nullptr);
+            memoryAllocator.free(slot.outputMemory);
+        }
+        batchSlots.clear();
+    }
+
+    void startBatchDecode(size_t frame) {
+        BatchSlot& slot = batchSlots[frame % batchSlots.size()];
+        std::string filename = batchFrames[frame];
+        uint8_t* dst = static_cast<uint8_t*>(slot.inputMemory.mapped);
+        int width = static_cast<int>(colorTextureWidth), height = static_cast<int>(colorTextureHeight);
+        slot.decode = workerPool.submit([filename, dst, width, height]() {
+            EncodedImage encoded = readImageFile(filename, "failed to load batch frame!");
+            if (encoded.width != width || encoded.height != height) {
+                throw std::runtime_error(std::string("batch frames must all have the size of the first one!") + ": " + filename);
+            }
+            decodeImageInto(encoded, dst, "failed to load batch frame!");
+        });
+    }
+
+    void startBatchEncode(size_t frame) {
+        BatchSlot& slot = batchSlots[frame % batchSlots.size()];
+        std::string filename = (std::filesystem::path(options.batchOutputDir) / std::filesystem::path(batchFrames[frame]).stem()).string() + ".png";
+        const uint8_t* pixels = static_cast<const uint8_t*>(slot.outputMemory.mapped);
+        int width = static_cast<int>(swapChainExtent.width), height = static_cast<int>(swapChainExtent.height);
+        slot.encode = workerPool.submit([filename, pixels, width, height]() {
+            if (!stbi_write_png(filename.c_str(), width, height, 4, pixels, width * 4)) {
+                throw std::runtime_error(std::string("failed to write batch frame!") + ": " + filename);
+            }
+        });
+    }
+
+    // The frame's fence must have signalled (the readback memory is host coherent, no invalidation needed)
+    void writeReadback(size_t frame, const std::string& filename) {
+        const void* pixels = readbackBuffersMemory[frame].mapped;
+        int stride = static_cast<int>(swapChainExtent.width * 4);
+        if (!stbi_write_png(filename.c_str(), swapChainExtent.width, swapChainExtent.height, 4, pixels, stride)) {
+            throw std::runtime_error("failed to write output image!");
+        }
+    }
+
+    CpuWarpEngine::Settings cpuWarpSettings(uint32_t width, uint32_t height) const {
+        CpuWarpEngine::Settings settings;
+        settings.mode = options.warpMode;
+        settings.applyIntensity = options.applyIntensity;
+        settings.nearestWarp = options.nearestWarp;
+        settings.quadMin = (*quadVertices)[0].pos; // texCoord (0, 0)
+        settings.quadMax = (*quadVertices)[2].pos; // texCoord (1, 1)
+        settings.outputWidth = width;
+        settings.outputHeight = height;
+        return settings;
+    }
+
+    // --write-warp-map: converting the MS/LS pair to a .vwm with its mip chain, without any window or Vulkan device
+    void convertWarpMap(const std::string& msFilename, const std::string& lsFilename) {
+        DecodedImage uvMS = decodeImage(msFilename, "failed to load uv MS texture image!");
+        DecodedImage uvLS = decodeImage(lsFilename, "failed to load uv LS texture image!");
+        combineWarpMapPair(uvMS, uvLS, warpMap);
+        uint32_t precision = options.floatWarpMap ? WARP_MAP_FLOAT32 : WARP_MAP_UNORM16;
+        if (!writeWarpMap(options.writeWarpMapFile.c_str(), uvMS.width, uvMS.height, warpMap.data(), precision, true)) {
+            throw std::runtime_error("failed to write warp map file!");
+        }
+        std::cout << "warp map written to " << options.writeWarpMapFile << std::endl;
+    }
+
+    // --cpu-warp: the whole warp done by CpuWarpEngine on the worker pool, no window and no Vulkan device
+    void runCpuWarp(const std::string& msFilename, const std::string& lsFilename, bool fullscreen) {
+        if (options.textureCache) {
+            textureCache.init(options.textureCacheDir, options.textureCacheMaxBytes);
+        }
+        quadVertices = fullscreen ? &verticesFull : &verticesQuad;
+        std::shared_ptr<WarpMapUpdate> warp = loadWarpMapUpdate(options.warpMapFile, msFilename, lsFilename, false, textureCache);
+        DecodedImage color = textureCache.enabled() ? decodeImageCached(options.colorImageFile, "failed to load colour texture image!", textureCache)
+                                                    : decodeImage(options.colorImageFile, "failed to load colour texture image!");
+        CpuWarpEngine engine;
+        engine.init(warp->uvi, warp->width, warp->height, cpuWarpSettings(options.outputWidth, options.outputHeight));
+        std::vector<uint8_t> output(size_t(options.outputWidth) * options.outputHeight * 4);
+        unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+
+        if (options.cpuWarpBenchmark) {
+            benchmarkCpuWarp(engine, color, output);
+        } else {
+            CpuWarpIsa isa = options.cpuWarpIsa == CPU_WARP_AUTO ? CpuWarpEngine::best() : options.cpuWarpIsa;
+            if (!CpuWarpEngine::supported(isa)) {
+                throw std::runtime_error(std::string("the CPU does not support the ") + CpuWarpEngine::name(isa) + " warp path!");
+            }
+            auto start = std::chrono::steady_clock::now();
+            for (uint32_t i = 0; i < options.frames; i++) {
+                engine.warp(color.data(), color.width, color.height, output.data(), isa, workerPool, threads);
+            }
+            auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            std::cout << options.frames << " frames warped on the CPU (" << CpuWarpEngine::name(isa) << ", " << threads << " threads) in "
+                      << micros / 1000.0 << " ms (" << options.frames * 1e6 / std::max<int64_t>(micros, 1) << " fps, "
+                      << double(options.frames) * output.size() / 4 / std::max<int64_t>(micros, 1) << " Mpixel/s)" << std::endl;
+        }
+
+        if (!options.outputFile.empty()) {
+            if (!stbi_write_png(options.outputFile.c_str(), options.outputWidth, options.outputHeight, 4, output.data(), options.outputWidth * 4)) {
+                throw std::runtime_error("failed to write output image!");
+            }
+            std::cout << "Output written to " << options.outputFile << std::endl;
+        }
+        textureCache.report();
+    }
+
+    // Every supported path, on one thread and on the whole pool, checked against the scalar output
+    void benchmarkCpuWarp(const CpuWarpEngine& engine, const DecodedImage& color, std::vector<uint8_t>& output) {
+        std::vector<uint8_t> reference(output.size());
+        engine.warp(color.data(), color.width, color.height, reference.data(), CPU_WARP_SCALAR, workerPool, 1);
+        unsigned allThreads = std::max(2u, std::thread::hardware_concurrency());
+        for (CpuWarpIsa isa : {CPU_WARP_SCALAR, CPU_WARP_SSE41, CPU_WARP_AVX2}) {
+            if (!CpuWarpEngine::supported(isa)) {
+                std::cout << CpuWarpEngine::name(isa) << ": not supported" << std::endl;
+                continue;
+            }
+            for (unsigned threads : {1u, allThreads}) {
+                engine.warp(color.data(), color.width, color.height, output.data(), isa, workerPool, threads); // warm-up
+                auto start = std::chrono::steady_clock::now();
+                for (uint32_t i = 0; i < options.frames; i++) {
+                    engine.warp(color.data(), color.width, color.height, output.data(), isa, workerPool, threads);
+                }
+                auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+                std::cout << CpuWarpEngine::name(isa) << ", " << threads << " thread(s): "
+                          << options.frames * 1000.0 / std::max<int64_t>(micros, 1) << " ms per frame, "
+                          << double(options.frames) * output.size() / 4 / std::max<int64_t>(micros, 1) << " Mpixel/s"
+                          << (output == reference ? "" : " (OUTPUT DIFFERS FROM SCALAR)") << std::endl;
+            }
+        }
+    }
+
+    // --validate: the last headless frame against CpuWarpEngine on the same inputs, false when the difference goes past
+    // VALIDATE_MAX_DIFFERENCE or VALIDATE_MAX_MEAN_DIFFERENCE. Small differences are expected (the GPU filters in floating
+    // point, or with its own weight precision), larger ones point at a shader or upload problem. The warp sampler is
+    // limited to level 0 when validating, the only level the CPU warp samples.
+    // Alpha is not compared: the coverage mesh leaves the clear color where the shader would have scaled alpha to zero.
+    bool validateWithCpuWarp(size_t frame) {
+        DecodedImage color = decodeImage(options.colorImageFile, "failed to load colour texture image!");
+        CpuWarpEngine engine;
+        engine.init(warpMap, warpMapWidth, warpMapHeight, cpuWarpSettings(swapChainExtent.width, swapChainExtent.height));
+        std::vector<uint8_t> expected(size_t(swapChainExtent.width) * swapChainExtent.height * 4);
+        engine.warp(color.data(), color.width, color.height, expected.data(), CPU_WARP_AUTO, workerPool,
+                    std::max(2u, std::thread::hardware_concurrency()));
+
+        const uint8_t* rendered = static_cast<const uint8_t*>(readbackBuffersMemory[frame].mapped);
+        uint32_t maxDifference = 0;
+        uint64_t totalDifference = 0, differingPixels = 0;
+        for (size_t i = 0; i < expected.size(); i += 4) {
+            uint32_t pixelDifference = 0;
+            for (size_t c = 0; c < 3; c++) {
+                uint32_t difference = static_cast<uint32_t>(std::abs(int(rendered[i + c]) - int(expected[i + c])));
+                pixelDifference = std::max(pixelDifference, difference);
+                totalDifference += difference;
+            }
+            maxDifference = std::max(maxDifference, pixelDifference);
+            differingPixels += pixelDifference > 2 ? 1 : 0;
+        }
+        double meanDifference = double(totalDifference) / (expected.size() / 4 * 3);
+        bool passed = maxDifference <= VALIDATE_MAX_DIFFERENCE && meanDifference <= VALIDATE_MAX_MEAN_DIFFERENCE;
+        std::cout << "validation against the CPU warp " << (passed ? "passed" : "FAILED") << ": max difference " << maxDifference
+                  << " (limit " << VALIDATE_MAX_DIFFERENCE << "), mean " << meanDifference << " (limit " << VALIDATE_MAX_MEAN_DIFFERENCE << "), "
+                  << differingPixels << " of " << expected.size() / 4 << " pixels off by more than 2" << std::endl;
+        return passed;
+    }
+
+    void cleanupSwapChain() {
+        for (auto framebuffer : swapChainFramebuffers) {
+            vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+            std::cout << "Framebuffer Destroyed" << std::endl;
+        }
 
         for (auto imgView : swapChainImageViews) {
             vkDestroyImageView(logicalDevice, imgView, nullptr);
             std::cout << "Image View Destroyed" << std::endl;
         }
 
-        vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
-        std::cout << "Swapchain Destroyed" << std::endl;
-
-        for (size_t i = 0; i < swapChainImages.size(); i++) {
-            vkDestroyBuffer(logicalDevice, uniformBuffers[i], nullptr);
-            vkFreeMemory(logicalDevice, uniformBuffersMemory[i], nullptr);
+        if (options.headless) {
+            for (size_t i = 0; i < swapChainImages.size(); i++) {
+                vkDestroyImage(logicalDevice, swapChainImages[i], nullptr);
+                memoryAllocator.free(offscreenImagesMemory[i]);
+                vkDestroyBuffer(logicalDevice, readbackBuffers[i], nullptr);
+                memoryAllocator.free(readbackBuffersMemory[i]);
+            }
+            std::cout << "Offscreen Targets Destroyed" << std::endl;
+            return;
         }
 
-        vkDestroyBuffer(logicalDevice, colorStagingBuffer, nullptr);
-        vkFreeMemory(logicalDevice, colorStagingBufferMemory, nullptr);
+        vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
+        std::cout << "Swapchain Destroyed" << std::endl;
 
-        vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
     }
 
     // Destroying Vulkan and GLFW instances before exit
     void cleanup() {
+        flushDeletionQueue(true);
+        cleanupWarpReload();
         cleanupSwapChain();
 
+        // pipeline and render passes survive swap chain recreation (viewport and scissor are dynamic)
+        vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
+        std::cout << "Graphics Pipeline Destroyed" << std::endl;
+        vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+        std::cout << "Pipeline Layout Destroyed" << std::endl;
+        vkDestroyRenderPass(logicalDevice ,renderPass, nullptr);
+        if (options.damageTracking) {
+            vkDestroyRenderPass(logicalDevice, renderPassLoad, nullptr);
+        }
+        std::cout << "Render Pass Destroyed" << std::endl;
+
+        // per-frame resources (no longer tied to the swap chain images)
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            vkDestroyBuffer(logicalDevice, uniformBuffers[i], nullptr);
+            memoryAllocator.free(uniformBuffersMemory[i]);
+
+            vkDestroyBuffer(logicalDevice, stagingRings[i].buffer, nullptr);
+            memoryAllocator.free(stagingRings[i].memory);
+
+            vkDestroyImageView(logicalDevice, colorTextureImageViews[i], nullptr);
+            vkDestroyImage(logicalDevice, colorTextureImages[i], nullptr);
+            memoryAllocator.free(colorTextureImagesMemory[i]);
+        }
+
+        vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
+
         vkDestroySampler(logicalDevice, textureSampler, nullptr);
-        
-        vkDestroyImageView(logicalDevice, colorTextureImageView, nullptr);
-        vkDestroyImage(logicalDevice, colorTextureImage, nullptr);
-        vkFreeMemory(logicalDevice, colorTextureImageMemory, nullptr);
 
-        vkDestroyImageView(logicalDevice, uvLSTextureImageView, nullptr);
-        vkDestroyImage(logicalDevice, uvLSTextureImage, nullptr);
-        vkFreeMemory(logicalDevice, uvLSTextureImageMemory, nullptr);
+        vkDestroySampler(logicalDevice, warpSampler, nullptr);
+
+        destroyWarpTexture(warpTexture);
+
+        vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+
+        savePipelineCache();
+        vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
+
+        vkDestroyBuffer(logicalDevice, indexBuffer, nullptr);
+        memoryAllocator.free(indexBufferMemory);
+
+        vkDestroyBuffer(logicalDevice, vertexBuffer, nullptr);
+        memoryAllocator.free(vertexBufferMemory);
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            vkDestroySemaphore(logicalDevice ,renderFinishedSemaphores[i], nullptr);
+            vkDestroySemaphore(logicalDevice, imgAvailSemaphores[i], nullptr);
+            vkDestroyFence(logicalDevice, inFlightFences[i], nullptr);
+            if (transferQueueDedicated) {
+                vkDestroySemaphore(logicalDevice, uploadCompleteSemaphores[i], nullptr);
+            }
+            std::cout << "Sync Objects Destroyed" << std::endl;
+        }
+
+        if (transferQueueDedicated) {
+            vkDestroyCommandPool(logicalDevice, transferCommandPool, nullptr);
+            std::cout << "Transfer Command Pool Destroyed" << std::endl;
+        }
+        vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+        std::cout << "Command Pool Destroyed" << std::endl;
+
+        //cleanupSwapChain();
+
+        for (size_t i = 0; i < captureImportBuffers.size(); i++) {
+            vkDestroyBuffer(logicalDevice, captureImportBuffers[i], nullptr);
+            vkFreeMemory(logicalDevice, captureImportBuffersMemory[i], nullptr);
+        }
+
+        memoryAllocator.report();
+        memoryAllocator.destroy();
+
+        vkDestroyDevice(logicalDevice, nullptr);
+        std::cout << "Logical Device Destroyed" << std::endl;
+
+        if(enableValidationLayers) {
+            DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+            std::cout << "Debug Messenger Destroyed" << std::endl;
+        }
+
+        if (!options.headless) {
+            vkDestroySurfaceKHR(instance, surface, nullptr);
+            std::cout << "Surface Destroyed" << std::endl;
+        }
+        vkDestroyInstance(instance, nullptr);
+        std::cout << "Instance Destroyed" << std::endl;
+        if (options.headless) {
+            return; // no window, nor display connection
+        }
+        #if __linux__
+            cleanupScreenCapture();
+            XCloseDisplay(display);
+        #endif
+        glfwDestroyWindow(window);
+        std::cout << "Window Destroyed" << std::endl;
+        glfwTerminate();
+    }
+
+    // Rebuilding only the extent-dependent objects, without stalling the device: the old swap chain is handed to the new one
+    // and its image views and framebuffers are destroyed once the frames still using them have completed
+    // (the surface format does not change on resize, so render passes and pipeline are kept)
+    void recreateSwapChain() {
+        // a minimised window has no framebuffer to draw to, wait for it to be restored (any other size goes straight on)
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(window, &width, &height);
+        while (width == 0 || height == 0) {
+            glfwWaitEvents();
+            glfwGetFramebufferSize(window, &width, &height);
+        }
+
+        VkSwapchainKHR oldSwapChain = swapChain;
+        std::vector<VkImageView> oldImageViews = swapChainImageViews;
+        std::vector<VkFramebuffer> oldFramebuffers = swapChainFramebuffers;
+
+        createSwapChain();
+        createImageViews();
+        createFramebuffers();
+        buildTileDependencyIndex();
+        if (coverageMeshEnabled()) {
+            // the filter footprint depends on the output size
+            std::vector<Vertex> meshVertices;
+            std::vector<uint32_t> meshIndices;
+            buildDrawMesh(meshVertices, meshIndices);
+            replaceDrawMesh(meshVertices, meshIndices);
+        }
+
+        deletionQueue.push_back({submittedFrames, [this, oldSwapChain, oldImageViews, oldFramebuffers]() {
+            for (auto framebuffer : oldFramebuffers) {
+                vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+            }
+            for (auto imgView : oldImageViews) {
+                vkDestroyImageView(logicalDevice, imgView, nullptr);
+            }
+            vkDestroySwapchainKHR(logicalDevice, oldSwapChain, nullptr);
+            std::cout << "Old Swapchain Destroyed" << std::endl;
+        }});
+    }
+
+    // Destroying the retired objects whose last frame has completed (all of them on exit, after the device is idle)
+    void flushDeletionQueue(bool all) {
+        for (auto it = deletionQueue.begin(); it != deletionQueue.end();) {
+            if (all || frameCompleted(it->lastUseFrame)) {
+                it->destroy();
+                it = deletionQueue.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Whether every frame up to frame has completed on the GPU
+    bool frameCompleted(uint64_t frame) {
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            // a fence submitted again after the frame has been waited for in between; otherwise it covers the frame itself
+            if (frameSubmissions[i] <= frame && vkGetFenceStatus(logicalDevice, inFlightFences[i]) != VK_SUCCESS) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Watching the directories of the warp map files rather than the files, which editors and generators often replace
+    void initWarpWatch() {
+        #if __linux__
+            warpWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (warpWatchFd < 0) {
+                throw std::runtime_error("failed to initialise inotify!");
+            }
+            std::vector<std::string> files = {options.warpMapFile};
+            if (options.warpMapFile.empty()) {
+                files = {uvMSFile, uvLSFile};
+            }
+            for (const std::string& file : files) {
+                std::filesystem::path path(file);
+                std::string dir = path.has_parent_path() ? path.parent_path().string() : ".";
+                int watch = inotify_add_watch(warpWatchFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+                if (watch < 0) {
+                    throw std::runtime_error(std::string("failed to watch the warp map directory!") + ": " + dir);
+                }
+                warpWatches.push_back({watch, path.filename().string()});
+                std::cout << "watching " << file << std::endl;
+            }
+        #else
+            std::cout << "warp map watching needs inotify, --watch-warp-map ignored" << std::endl;
+        #endif
+    }
+
+    // Draining the pending inotify events without blocking, a write to a warp map file (re)starts the settle time
+    void readWarpWatch() {
+        #if __linux__
+            alignas(struct inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(warpWatchFd, buffer, sizeof(buffer))) > 0) {
+                for (char* entry = buffer; entry < buffer + length;) {
+                    const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(entry);
+                    for (const auto& watch : warpWatches) {
+                        if (event->wd == watch.first && event->len > 0 && watch.second == event->name) {
+                            warpChangePending = true;
+                            warpChangeTime = std::chrono::steady_clock::now();
+                        }
+                    }
+                    entry += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        #endif
+    }
+
+    template <typename T>
+    static bool isReady(const std::future<T>& job) {
+        return job.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
 
-        vkDestroyImageView(logicalDevice, uvMSTextureImageView, nullptr);
-        vkDestroyImage(logicalDevice, uvMSTextureImage, nullptr);
-        vkFreeMemory(logicalDevice, uvMSTextureImageMemory, nullptr);
+    // One step of the warp map hot reload per frame, nothing here waits for the worker pool or the GPU
+    void updateWarpReload() {
+        readWarpWatch();
+        if (warpReloadState == WARP_RELOAD_IDLE) {
+            if (warpChangePending && std::chrono::steady_clock::now() - warpChangeTime > std::chrono::milliseconds(WARP_RELOAD_SETTLE_MS)) {
+                warpChangePending = false;
+                std::cout << "warp map changed, reloading..." << std::endl;
+                TextureCache* cache = &textureCache;
+                std::string warpMapFile = options.warpMapFile, msFilename = uvMSFile, lsFilename = uvLSFile;
+                bool floatTexels = options.floatWarpMap;
+                warpReloadDecode = workerPool.submit([warpMapFile, msFilename, lsFilename, floatTexels, cache]() {
+                    return loadWarpMapUpdate(warpMapFile, msFilename, lsFilename, floatTexels, *cache);
+                });
+                warpReloadState = WARP_RELOAD_DECODING;
+            }
+        } else if (warpReloadState == WARP_RELOAD_DECODING) {
+            if (isReady(warpReloadDecode)) {
+                startWarpReloadCopy();
+            }
+        } else if (warpReloadState == WARP_RELOAD_COPYING) {
+            if (isReady(warpReloadCopy)) {
+                submitWarpReload();
+            }
+        } else if (vkGetFenceStatus(logicalDevice, warpReloadFence) == VK_SUCCESS) {
+            switchWarpMap();
+        }
+    }
 
-        vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+    // Choosing the image and the regions to upload for the decoded warp map, then packing them into a staging buffer on the worker pool.
+    // The spare image (the warp map displayed before the last switch) only receives the texels differing from the new map,
+    // a warp map of another size or format gets a new image.
+    void startWarpReloadCopy() {
+        try {
+            warpReload = warpReloadDecode.get();
+        } catch (const std::exception& e) {
+            // e.g. one of the files caught while being written, the next change tries again
+            std::cout << "warp map reload failed: " << e.what() << std::endl;
+            warpReloadState = WARP_RELOAD_IDLE;
+            return;
+        }
+        const WarpMapUpdate& update = *warpReload;
+        uint32_t levels = static_cast<uint32_t>(update.levels.size());
+
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, update.format, &formatProperties);
+        if (update.format != warpTexFormat && !(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+            std::cout << "warp map reload skipped, its format cannot be filtered by the warp map sampler" << std::endl;
+            warpReload.reset();
+            warpReloadState = WARP_RELOAD_IDLE;
+            return;
+        }
 
-        vkDestroyBuffer(logicalDevice, indexBuffer, nullptr);
-        vkFreeMemory(logicalDevice, indexBufferMemory, nullptr);
+        VkRect2D wholeMap = {{0, 0}, {update.width, update.height}};
+        warpReloadDifference = wholeMap;
+        if (update.width == warpMapWidth && update.height == warpMapHeight
+            && !warpMapDifference(warpMap, update.uvi, update.width, update.height, warpReloadDifference)) {
+            std::cout << "warp map unchanged" << std::endl;
+            warpReload.reset();
+            warpReloadState = WARP_RELOAD_IDLE;
+            return;
+        }
 
-        vkDestroyBuffer(logicalDevice, vertexBuffer, nullptr);
-        vkFreeMemory(logicalDevice, vertexBufferMemory, nullptr);
+        warpReloadInPlace = spareWarpTexture.uvImage != VK_NULL_HANDLE && spareWarpFormat == update.format && spareWarpWidth == update.width
+                            && spareWarpHeight == update.height && spareWarpLevels == levels;
+        VkRect2D upload = wholeMap;
+        if (warpReloadInPlace) {
+            // the spare image differs from the displayed map by spareWarpDifference, which differs from the new one by warpReloadDifference
+            int32_t x0 = std::min(spareWarpDifference.offset.x, warpReloadDifference.offset.x);
+            int32_t y0 = std::min(spareWarpDifference.offset.y, warpReloadDifference.offset.y);
+            int32_t x1 = std::max(spareWarpDifference.offset.x + spareWarpDifference.extent.width, warpReloadDifference.offset.x + warpReloadDifference.extent.width);
+            int32_t y1 = std::max(spareWarpDifference.offset.y + spareWarpDifference.extent.height, warpReloadDifference.offset.y + warpReloadDifference.extent.height);
+            upload = {{x0, y0}, {static_cast<uint32_t>(x1 - x0), static_cast<uint32_t>(y1 - y0)}};
+        }
 
-        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vkDestroySemaphore(logicalDevice ,renderFinishedSemaphores[i], nullptr);
-            vkDestroySemaphore(logicalDevice, imgAvailSemaphores[i], nullptr);
-            vkDestroyFence(logicalDevice, inFlightFences[i], nullptr);
-            std::cout << "Sync Objects Destroyed" << std::endl;
+        // the rectangle covers ceil(extent / 2^level) texels of each mip level (box filtered), in both images
+        warpReloadRegions.clear();
+        warpReloadIntensityRegions.clear();
+        VkDeviceSize stagingSize = 0;
+        for (uint32_t level = 0; level < levels; level++) {
+            const WarpMapLevel& info = update.levels[level];
+            uint32_t x0 = std::min<uint32_t>(upload.offset.x >> level, info.width - 1);
+            uint32_t y0 = std::min<uint32_t>(upload.offset.y >> level, info.height - 1);
+            uint32_t x1 = std::max(std::min<uint32_t>((upload.offset.x + upload.extent.width + (1u << level) - 1) >> level, info.width), x0 + 1);
+            uint32_t y1 = std::max(std::min<uint32_t>((upload.offset.y + upload.extent.height + (1u << level) - 1) >> level, info.height), y0 + 1);
+
+            VkBufferImageCopy region = {};
+            region.bufferOffset = stagingSize;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = level;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {static_cast<int32_t>(x0), static_cast<int32_t>(y0), 0};
+            region.imageExtent = {x1 - x0, y1 - y0, 1};
+            warpReloadRegions.push_back(region);
+            stagingSize += (VkDeviceSize((x1 - x0)) * (y1 - y0) * update.texelSize + 15) & ~VkDeviceSize(15); // keeps the texel alignment
+            region.bufferOffset = stagingSize;
+            warpReloadIntensityRegions.push_back(region);
+            stagingSize += (VkDeviceSize((x1 - x0)) * (y1 - y0) + 15) & ~VkDeviceSize(15);
         }
 
-        vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
-        std::cout << "Command Pool Destroyed" << std::endl;
+        if (warpReloadInPlace) {
+            warpReloadTexture = spareWarpTexture;
+        } else {
+            warpReloadTexture = createWarpTexture(update.width, update.height, update.format, levels, transferQueueDedicated);
+        }
+        createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     warpReloadStagingBuffer, warpReloadStagingMemory, ALLOCATION_LINEAR);
+        std::cout << "uploading " << upload.extent.width << "x" << upload.extent.height << " warp map texels"
+                  << (warpReloadInPlace ? " into the spare image" : " into a new image") << std::endl;
+
+        std::shared_ptr<WarpMapUpdate> job = warpReload;
+        std::vector<VkBufferImageCopy> regions = warpReloadRegions, intensityRegions = warpReloadIntensityRegions;
+        uint8_t* staging = static_cast<uint8_t*>(warpReloadStagingMemory.mapped);
+        std::shared_ptr<WarpMesh> mesh;
+        if (options.meshWarp) {
+            warpReloadMesh = std::make_shared<WarpMesh>();
+            mesh = warpReloadMesh;
+        }
+        glm::vec2 quadMin = (*quadVertices)[0].pos, quadMax = (*quadVertices)[2].pos;
+        uint32_t colorWidth = colorTextureWidth, colorHeight = colorTextureHeight;
+        float maxError = options.meshWarpMaxError;
+        bool cullBlack = options.applyIntensity;
+        warpReloadCopy = workerPool.submit([job, regions, intensityRegions, staging, mesh, quadMin, quadMax, colorWidth, colorHeight, maxError,
+                                            cullBlack]() {
+            copyWarpMapRegions(*job, regions, intensityRegions, staging);
+            if (mesh) {
+                *mesh = buildWarpMesh(job->uvi, job->width, job->height, quadMin, quadMax, colorWidth, colorHeight, maxError, cullBlack);
+            }
+        });
+        warpReloadState = WARP_RELOAD_COPYING;
+    }
 
-        //cleanupSwapChain();
+    // Submitting the upload on the transfer queue (graphics queue without a dedicated one), signalling warpReloadSemaphore
+    void submitWarpReload() {
+        // the spare image may still be sampled by the frames submitted before the last switch
+        if (warpReloadInPlace && !frameCompleted(spareWarpLastUse)) {
+            return;
+        }
+        warpReloadCopy.get();
+
+        if (warpReloadCommandBuffer == VK_NULL_HANDLE) {
+            VkCommandBufferAllocateInfo cbAllocateInfo = {};
+            cbAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            cbAllocateInfo.commandPool = transferQueueDedicated ? transferCommandPool : commandPool;
+            cbAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            cbAllocateInfo.commandBufferCount = 1;
+            if (vkAllocateCommandBuffers(logicalDevice, &cbAllocateInfo, &warpReloadCommandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate warp map reload command buffer!");
+            }
+        }
 
-        vkDestroyDevice(logicalDevice, nullptr);
-        std::cout << "Logical Device Destroyed" << std::endl;
+        // the frame switching to the new map waits for the semaphore in its fragment shader stage, which makes the copy visible
+        uint32_t levels = static_cast<uint32_t>(warpReload->levels.size());
+        beginFrameCommandBuffer(warpReloadCommandBuffer);
+        for (bool intensity : {false, true}) {
+            VkImage image = intensity ? warpReloadTexture.intensityImage : warpReloadTexture.uvImage;
+            const std::vector<VkBufferImageCopy>& regions = intensity ? warpReloadIntensityRegions : warpReloadRegions;
+            recordImageBarrier(warpReloadCommandBuffer, image,
+                               warpReloadInPlace ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, levels);
+                vkCmdCopyBufferToImage(warpReloadCommandBuffer, warpReloadStagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                       static_cast<uint32_t>(regions.size()), regions.data());
+            recordImageBarrier(warpReloadCommandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                               VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, levels);
+        }
+        endFrameCommandBuffer(warpReloadCommandBuffer);
 
-        if(enableValidationLayers) {
-            DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
-            std::cout << "Debug Messenger Destroyed" << std::endl;
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &warpReloadCommandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &warpReloadSemaphore;
+        vkResetFences(logicalDevice, 1, &warpReloadFence);
+        if (vkQueueSubmit(transferQueueDedicated ? transferQueue : graphicsQueue, 1, &submitInfo, warpReloadFence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit warp map reload!");
         }
+        warpReloadState = WARP_RELOAD_UPLOADING;
+    }
 
-        vkDestroySurfaceKHR(instance, surface, nullptr);
-        std::cout << "Surface Destroyed" << std::endl;
-        vkDestroyInstance(instance, nullptr);
-        std::cout << "Instance Destroyed" << std::endl;
-        #if __linux__
-            XCloseDisplay(display);
-        #endif
-        glfwDestroyWindow(window);
-        std::cout << "Window Destroyed" << std::endl;
-        glfwTerminate();
+    // Switching to the uploaded warp map from this frame on: its descriptor set is updated now, the other frames' sets
+    // after their fences (refreshWarpDescriptor). The previously displayed image becomes the spare one.
+    void switchWarpMap() {
+        vkDestroyBuffer(logicalDevice, warpReloadStagingBuffer, nullptr);
+        memoryAllocator.free(warpReloadStagingMemory);
+        warpReloadStagingBuffer = VK_NULL_HANDLE;
+
+        if (!warpReloadInPlace && spareWarpTexture.uvImage != VK_NULL_HANDLE) {
+            WarpTexture texture = spareWarpTexture;
+            deletionQueue.push_back({spareWarpLastUse, [this, texture]() {
+                destroyWarpTexture(texture);
+            }});
+        }
+        spareWarpTexture = warpTexture;
+        spareWarpFormat = warpTexFormat;
+        spareWarpWidth = warpMapWidth;
+        spareWarpHeight = warpMapHeight;
+        spareWarpLevels = warpMapLevels;
+        spareWarpLastUse = submittedFrames;
+        spareWarpDifference = warpReloadDifference;
+
+        warpTexture = warpReloadTexture;
+        warpTexFormat = warpReload->format;
+        warpMapWidth = warpReload->width;
+        warpMapHeight = warpReload->height;
+        warpMapLevels = static_cast<uint32_t>(warpReload->levels.size());
+        warpMap.swap(warpReload->uvi);
+        warpReload.reset();
+        warpReloadTexture = WarpTexture();
+
+        warpDescriptorStale.fill(true);
+        waitForWarpReload = true;
+        buildTileDependencyIndex(); // the whole output is redrawn with the new map
+        if (warpReloadMesh) {
+            reportMeshWarp(*warpReloadMesh);
+            if (warpReloadMesh->indices.empty()) {
+                warpReloadMesh->vertices = {(*quadVertices)[0]}; // black warp map, see buildDrawMesh
+                warpReloadMesh->indices = {0, 0, 0};
+            }
+            replaceDrawMesh(warpReloadMesh->vertices, warpReloadMesh->indices);
+            warpReloadMesh.reset();
+        } else if (coverageMeshEnabled()) {
+            std::vector<Vertex> meshVertices;
+            std::vector<uint32_t> meshIndices;
+            buildDrawMesh(meshVertices, meshIndices);
+            replaceDrawMesh(meshVertices, meshIndices);
+        }
+        warpReloadState = WARP_RELOAD_IDLE;
+        std::cout << "warp map reloaded" << std::endl;
     }
 
-    void recreateSwapChain() {
-        int width = 0, height = 0;
-        while (width == 0 || height == 0) {
-            glfwGetFramebufferSize(window, &width , &height);
-            glfwWaitEvents;
+    // Pointing this frame's descriptor set at the current warp map, once the frame that last used it has completed
+    void refreshWarpDescriptor() {
+        if (!warpDescriptorStale[currentFrame]) {
+            return;
         }
-        
-        vkDeviceWaitIdle(logicalDevice);
+        warpDescriptorStale[currentFrame] = false;
+
+        // uv image at binding 1, intensity image at binding 3
+        std::array<VkDescriptorImageInfo, 2> descriptorWarpImageInfos = {};
+        std::array<VkWriteDescriptorSet, 2> writeDescriptorSet = {};
+        for (size_t i = 0; i < 2; i++) {
+            descriptorWarpImageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            descriptorWarpImageInfos[i].imageView = i == 0 ? warpTexture.uvView : warpTexture.intensityView;
+            descriptorWarpImageInfos[i].sampler = warpSampler;
+
+            writeDescriptorSet[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writeDescriptorSet[i].dstSet = descriptorSets[currentFrame];
+            writeDescriptorSet[i].dstBinding = i == 0 ? 1 : 3;
+            writeDescriptorSet[i].dstArrayElement = 0;
+            writeDescriptorSet[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writeDescriptorSet[i].descriptorCount = 1;
+            writeDescriptorSet[i].pImageInfo = &descriptorWarpImageInfos[i];
+        }
+        vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writeDescriptorSet.size()), writeDescriptorSet.data(), 0, nullptr);
+    }
 
-        createSwapChain();
-        createImageViews();
-        createRenderPass();
-        createGraphicsPipeline();
-        createFramebuffers();
-        createUniformBuffer();
-        createDescriptorPool();
-        createDescriptorSets();
-        createCommandBuffers();
+    // Releasing what the hot reload holds, after the device is idle (a job still running on the worker pool is waited for)
+    void cleanupWarpReload() {
+        if (warpReloadDecode.valid()) {
+            warpReloadDecode.wait();
+        }
+        if (warpReloadCopy.valid()) {
+            warpReloadCopy.wait();
+        }
+        if (warpReloadStagingBuffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(logicalDevice, warpReloadStagingBuffer, nullptr);
+            memoryAllocator.free(warpReloadStagingMemory);
+        }
+        if (warpReloadTexture.uvImage != VK_NULL_HANDLE && !warpReloadInPlace) {
+            destroyWarpTexture(warpReloadTexture);
+        }
+        if (spareWarpTexture.uvImage != VK_NULL_HANDLE) {
+            destroyWarpTexture(spareWarpTexture);
+        }
+        if (warpReloadFence != VK_NULL_HANDLE) {
+            vkDestroyFence(logicalDevice, warpReloadFence, nullptr);
+            vkDestroySemaphore(logicalDevice, warpReloadSemaphore, nullptr);
+        }
+        #if __linux__
+            if (warpWatchFd >= 0) {
+                close(warpWatchFd);
+            }
+        #endif
     }
 
     // Initialising Application Metadata, checking supported extensions and initialising Vulkan instance
@@ -535,21 +3288,42 @@ private:
         for (const auto& device : devices) {
             if (isDeviceSuitable(device)) {
                 std::cout << "this device is suitable!" << std::endl;
+                // headless runs also accept software rasterisers (lavapipe, SwiftShader), but only when there is no GPU
+                if (options.headless && physicalDevice != VK_NULL_HANDLE && isCpuDevice(device)) {
+                    continue;
+                }
                 physicalDevice = device;
-                break;
+                if (!options.headless || !isCpuDevice(device)) {
+                    break;
+                }
             }
         }
 
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find a suitable GPU");
         }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        std::cout << "Using " << properties.deviceName << std::endl;
+    }
+
+    bool isCpuDevice(VkPhysicalDevice device) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+        return properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
     }
 
     void createLogicalDevice() {
         QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        // streamed captures and warp map reloads go through the transfer queue
+        transferQueueDedicated = (capture || options.watchWarpMap) && options.transferQueue && indices.transferFamily.has_value();
 
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+        if (transferQueueDedicated) {
+            uniqueQueueFamilies.insert(indices.transferFamily.value());
+        }
 
         float queuePriority = 1.0f;
         for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -562,15 +3336,29 @@ private:
         }
 
         VkPhysicalDeviceFeatures deviceFeatures = {}; // to be populated later (if special capabilities are required)
-        deviceFeatures.samplerAnisotropy = VK_TRUE;
+        deviceFeatures.samplerAnisotropy = options.headless ? VK_FALSE : VK_TRUE; // not required headless (no sampler enables it)
 
         VkDeviceCreateInfo createInfo = {};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
+        std::vector<const char*> enabledExtensions;
+        if (!options.headless) {
+            enabledExtensions.assign(deviceExtensions.begin(), deviceExtensions.end());
+        }
+        if (capture && options.importHostMemory) {
+            hostMemoryImport = checkHostMemoryImportSupport(physicalDevice);
+            if (hostMemoryImport) {
+                enabledExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+                enabledExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+            } else {
+                std::cout << "VK_EXT_external_memory_host not supported, captures are copied into the staging buffer" << std::endl;
+            }
+        }
+
         createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+        createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
         if (enableValidationLayers) {
             createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -587,6 +3375,11 @@ private:
 
         vkGetDeviceQueue(logicalDevice, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(logicalDevice, indices.presentFamily.value(), 0, &presentQueue);
+        if (transferQueueDedicated) {
+            vkGetDeviceQueue(logicalDevice, indices.transferFamily.value(), 0, &transferQueue);
+            std::cout << "Using transfer queue family " << indices.transferFamily.value() << " for capture uploads" << std::endl;
+        }
+        deviceQueueFamilies = indices;
     }
 
     void createSwapChain() {
@@ -629,8 +3422,8 @@ private:
         scCreateInfo.preTransform = swapChainSupport.surfaceCapabilities.currentTransform; // it can be modified to force one transformation at HW level (if supported)
         scCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR; // specifies if the alpha should be considered when blending with other windows (now ignored)
         scCreateInfo.presentMode = presentMode;
-        scCreateInfo.clipped = VK_TRUE; // ignores colour of hidden window pixels
-        scCreateInfo.oldSwapchain = VK_NULL_HANDLE; // sometimes (e.g. on resizing) the swap chain should be created again and the the handle of the old one have to be placed here (not used yet)
+        scCreateInfo.clipped = options.damageTracking ? VK_FALSE : VK_TRUE; // ignores colour of hidden window pixels (partial redraws need them all)
+        scCreateInfo.oldSwapchain = swapChain; // previous swap chain when resizing (VK_NULL_HANDLE at startup), retired by the new one
 
         std::cout << "...creating Swap Chain..." << std::endl;
         VkResult res = vkCreateSwapchainKHR(logicalDevice, &scCreateInfo, nullptr, &swapChain);
@@ -646,6 +3439,40 @@ private:
         swapChainExtent = extent;
     }
 
+    // Headless replacement of the swap chain: one offscreen target per frame in flight, plus the host-visible buffer each
+    // target is copied into at the end of its frame (see recordReadback)
+    void createOffscreenTargets() {
+        swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM; // written as is to PNG
+        swapChainExtent = {options.outputWidth, options.outputHeight};
+
+        VkMemoryPropertyFlags readbackProperties = readbackMemoryProperties();
+        swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+        offscreenImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        readbackBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        readbackBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        VkDeviceSize readbackSize = VkDeviceSize(swapChainExtent.width) * swapChainExtent.height * 4;
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            createImage(swapChainExtent.width, swapChainExtent.height, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        swapChainImages[i], offscreenImagesMemory[i]);
+            createBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, readbackProperties, readbackBuffers[i], readbackBuffersMemory[i]);
+        }
+    }
+
+    // Host reads from uncached memory are very slow, cached memory is used for readbacks whenever the device has it
+    VkMemoryPropertyFlags readbackMemoryProperties() {
+        VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            VkMemoryPropertyFlags cached = properties | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+            if ((memoryProperties.memoryTypes[i].propertyFlags & cached) == cached) {
+                return cached;
+            }
+        }
+        return properties;
+    }
+
     void createImageViews() {
         swapChainImageViews.resize(swapChainImages.size());
 
@@ -655,15 +3482,25 @@ private:
     }
 
     void createRenderPass() {
+        // offscreen targets are left ready to be copied into their readback buffer
+        VkImageLayout outputLayout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        renderPass = createRenderPass(VK_ATTACHMENT_LOAD_OP_CLEAR, VK_IMAGE_LAYOUT_UNDEFINED, outputLayout);
+        if (options.damageTracking) {
+            // compatible with renderPass, so the same pipeline and framebuffers are used with both
+            renderPassLoad = createRenderPass(VK_ATTACHMENT_LOAD_OP_LOAD, outputLayout, outputLayout);
+        }
+    }
+
+    VkRenderPass createRenderPass(VkAttachmentLoadOp loadOp, VkImageLayout initialLayout, VkImageLayout finalLayout) {
         VkAttachmentDescription colorAttachment = {};
         colorAttachment.format = swapChainImageFormat;
         colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; // what to do to the attachment data before displaying (keep old data/clear to black/don't care)
+        colorAttachment.loadOp = loadOp; // what to do to the attachment data before displaying (keep old data/clear to black/don't care)
         colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; // what to do to the attachment data after displaying (store old data/don't care)
         colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; // same as before but for stencil data (and not colour and alpha data)
         colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; // found attachment layout 
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; // how to use the attachment (color attachment/swap chain image/ destination for memory copy)
+        colorAttachment.initialLayout = initialLayout; // found attachment layout 
+        colorAttachment.finalLayout = finalLayout; // how to use the attachment (color attachment/swap chain image/ destination for memory copy)
 
         VkAttachmentReference colorAttachmentRef = {};
         colorAttachmentRef.attachment = 0;
@@ -674,13 +3511,20 @@ private:
         subpass.colorAttachmentCount = 1;
         subpass.pColorAttachments = &colorAttachmentRef; // this field store the pointer where the output of the fragment shader will be written
 
-        VkSubpassDependency subpassDependency = {};
-        subpassDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        subpassDependency.dstSubpass = 0;
-        subpassDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        subpassDependency.srcAccessMask = 0;
-        subpassDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        subpassDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        VkSubpassDependency subpassDependencies[2] = {};
+        subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        subpassDependencies[0].dstSubpass = 0;
+        subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        subpassDependencies[0].srcAccessMask = 0;
+        subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        // headless: the readback copy recorded after the render pass reads what the subpass wrote
+        subpassDependencies[1].srcSubpass = 0;
+        subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        subpassDependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
         VkRenderPassCreateInfo renderPassCreateInfo = {};
         renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -688,14 +3532,16 @@ private:
         renderPassCreateInfo.pAttachments = &colorAttachment;
         renderPassCreateInfo.subpassCount = 1;
         renderPassCreateInfo.pSubpasses = &subpass;
-        renderPassCreateInfo.dependencyCount = 1;
-        renderPassCreateInfo.pDependencies = &subpassDependency;
+        renderPassCreateInfo.dependencyCount = options.headless ? 2 : 1;
+        renderPassCreateInfo.pDependencies = subpassDependencies;
 
         std::cout << "...creating an render pass..." << std::endl;
-        VkResult res = vkCreateRenderPass(logicalDevice, &renderPassCreateInfo, nullptr, &renderPass);
+        VkRenderPass newRenderPass;
+        VkResult res = vkCreateRenderPass(logicalDevice, &renderPassCreateInfo, nullptr, &newRenderPass);
         if (res != VK_SUCCESS){
             throw std::runtime_error("failed to create render pass!");
         }
+        return newRenderPass;
     }
 
     void createDescriptorSetLayout() {
@@ -706,32 +3552,33 @@ private:
         uboLayoutBinding.pImmutableSamplers = nullptr;
         uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-        VkDescriptorSetLayoutBinding uvMSSamplerLayoutBinding = {};
-        uvMSSamplerLayoutBinding.binding = 1;
-        uvMSSamplerLayoutBinding.descriptorCount = 1;
-        uvMSSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        uvMSSamplerLayoutBinding.pImmutableSamplers = nullptr;
-        uvMSSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-        VkDescriptorSetLayoutBinding uvLSSamplerLayoutBinding = {};
-        uvLSSamplerLayoutBinding.binding = 2;
-        uvLSSamplerLayoutBinding.descriptorCount = 1;
-        uvLSSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        uvLSSamplerLayoutBinding.pImmutableSamplers = nullptr;
-        uvLSSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        VkDescriptorSetLayoutBinding warpSamplerLayoutBinding = {};
+        warpSamplerLayoutBinding.binding = 1;
+        warpSamplerLayoutBinding.descriptorCount = 1;
+        warpSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        warpSamplerLayoutBinding.pImmutableSamplers = nullptr;
+        warpSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
         VkDescriptorSetLayoutBinding colorSamplerLayoutBinding = {};
-        colorSamplerLayoutBinding.binding = 3;
+        colorSamplerLayoutBinding.binding = 2;
         colorSamplerLayoutBinding.descriptorCount = 1;
         colorSamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
         colorSamplerLayoutBinding.pImmutableSamplers = nullptr;
         colorSamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
+        // the warp intensity has its own image, only sampled when it is applied
+        VkDescriptorSetLayoutBinding intensitySamplerLayoutBinding = {};
+        intensitySamplerLayoutBinding.binding = 3;
+        intensitySamplerLayoutBinding.descriptorCount = 1;
+        intensitySamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        intensitySamplerLayoutBinding.pImmutableSamplers = nullptr;
+        intensitySamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
         std::array<VkDescriptorSetLayoutBinding, 4> bindings = {
             uboLayoutBinding,
-            uvMSSamplerLayoutBinding,
-            uvLSSamplerLayoutBinding,
-            colorSamplerLayoutBinding
+            warpSamplerLayoutBinding,
+            colorSamplerLayoutBinding,
+            intensitySamplerLayoutBinding
         };
         VkDescriptorSetLayoutCreateInfo dsLayoutCreateInfo = {};
         dsLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -746,9 +3593,6 @@ private:
     }
 
     void createGraphicsPipeline() {
-        auto vertShaderCode = readFile("shaders/vert.spv");
-        auto fragShaderCode = readFile("shaders/frag.spv");
-
         std::cout << "...creating Vertex Shader Module..." << std::endl;
         VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
         std::cout << "...creating Fragment Shader Module..." << std::endl;
@@ -766,6 +3610,39 @@ private:
         fragssCreateInfo.module = fragShaderModule;
         fragssCreateInfo.pName = "main";
 
+        // the decode mode is baked into the fragment shader, so each configuration compiles to a branch-free variant
+        struct FragmentSpecialization {
+            int32_t warpMode;
+            VkBool32 applyIntensity;
+            VkBool32 nearestWarp;
+            VkBool32 meshWarp;
+        } fragSpecialization = {
+            options.warpMode,
+            options.applyIntensity ? VK_TRUE : VK_FALSE,
+            options.nearestWarp ? VK_TRUE : VK_FALSE,
+            options.meshWarp ? VK_TRUE : VK_FALSE
+        };
+        std::array<VkSpecializationMapEntry, 4> fragSpecializationEntries = {};
+        fragSpecializationEntries[0].constantID = 0;
+        fragSpecializationEntries[0].offset = offsetof(FragmentSpecialization, warpMode);
+        fragSpecializationEntries[0].size = sizeof(int32_t);
+        fragSpecializationEntries[1].constantID = 1;
+        fragSpecializationEntries[1].offset = offsetof(FragmentSpecialization, applyIntensity);
+        fragSpecializationEntries[1].size = sizeof(VkBool32);
+        fragSpecializationEntries[2].constantID = 2;
+        fragSpecializationEntries[2].offset = offsetof(FragmentSpecialization, nearestWarp);
+        fragSpecializationEntries[2].size = sizeof(VkBool32);
+        fragSpecializationEntries[3].constantID = 3;
+        fragSpecializationEntries[3].offset = offsetof(FragmentSpecialization, meshWarp);
+        fragSpecializationEntries[3].size = sizeof(VkBool32);
+
+        VkSpecializationInfo fragSpecializationInfo = {};
+        fragSpecializationInfo.mapEntryCount = static_cast<uint32_t>(fragSpecializationEntries.size());
+        fragSpecializationInfo.pMapEntries = fragSpecializationEntries.data();
+        fragSpecializationInfo.dataSize = sizeof(fragSpecialization);
+        fragSpecializationInfo.pData = &fragSpecialization;
+        fragssCreateInfo.pSpecializationInfo = &fragSpecializationInfo;
+
         VkPipelineShaderStageCreateInfo shaderStages[] = {vertssCreateInfo, fragssCreateInfo};
 
         VkPipelineVertexInputStateCreateInfo vertInputCreateInfo = {};
@@ -784,28 +3661,13 @@ private:
         inputAssemblyStateCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST; // how the vertices are read
         inputAssemblyStateCreateInfo.primitiveRestartEnable = VK_FALSE;
 
-        VkViewport viewport = {};
-        // viewport center position wrt framebuffer
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        // viewport size
-        viewport.width  = (float) swapChainExtent.width;
-        viewport.height = (float) swapChainExtent.height;
-        // view depth
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-
-        // rectangle defining which part of the framebuffer is rendered
-        VkRect2D scissor = {};
-        scissor.offset = {0,0};
-        scissor.extent = swapChainExtent;
-
+        // viewport and scissor are dynamic (set in recordCommandBuffer), so the pipeline does not depend on the swap chain extent
         VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {};
         viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewportStateCreateInfo.viewportCount = 1;
-        viewportStateCreateInfo.pViewports = &viewport;
+        viewportStateCreateInfo.pViewports = nullptr;
         viewportStateCreateInfo.scissorCount = 1;
-        viewportStateCreateInfo.pScissors = &scissor;
+        viewportStateCreateInfo.pScissors = nullptr;
 
         VkPipelineRasterizationStateCreateInfo rasterizerStateCreateInfo = {};
         rasterizerStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -878,7 +3740,13 @@ private:
         graphicsPipelineCreateInfo.pMultisampleState = &multisampleStateCreateInfo;
         //graphicsPipelineCreateInfo.pDepthStencilState = nullptr;
         graphicsPipelineCreateInfo.pColorBlendState = &colorBlendStateCreateInfo;
-        //graphicsPipelineCreateInfo.pDynamicState = nullptr;
+        // viewport follows the swap chain extent, scissor is set per draw to redraw only the damaged output tiles
+        VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {};
+        dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicStateCreateInfo.dynamicStateCount = 2;
+        dynamicStateCreateInfo.pDynamicStates = dynamicStates;
+        graphicsPipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
         graphicsPipelineCreateInfo.layout = pipelineLayout;
         graphicsPipelineCreateInfo.renderPass = renderPass;
         graphicsPipelineCreateInfo.subpass = 0;
@@ -886,10 +3754,19 @@ private:
         //graphicsPipelineCreateInfo.basePipelineIndex = 0; // advanced option
 
         std::cout << "...creating pipeline..." << std::endl;
-        res = vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &graphicsPipelineCreateInfo, nullptr, &graphicsPipeline);
+        // a pipeline missing from the cache makes it grow (Vulkan 1.0 has no per-pipeline hit feedback)
+        size_t cacheSizeBefore = 0;
+        vkGetPipelineCacheData(logicalDevice, pipelineCache, &cacheSizeBefore, nullptr);
+        auto compileStart = std::chrono::steady_clock::now();
+        res = vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &graphicsPipelineCreateInfo, nullptr, &graphicsPipeline);
         if (res != VK_SUCCESS){
             throw std::runtime_error("failed to create pipeline!");
         }
+        auto compileMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - compileStart).count();
+        size_t cacheSizeAfter = 0;
+        vkGetPipelineCacheData(logicalDevice, pipelineCache, &cacheSizeAfter, nullptr);
+        std::cout << "pipeline created in " << compileMicros / 1000.0 << " ms (pipeline cache "
+                  << (cacheSizeAfter > cacheSizeBefore ? "miss" : "hit") << ")" << std::endl;
 
         vkDestroyShaderModule(logicalDevice, fragShaderModule, nullptr);
         std::cout << "Fragment Shader Destroyed" << std::endl;
@@ -897,6 +3774,121 @@ private:
         std::cout << "Vertex Shader Destroyed" << std::endl;
     }
 
+    // Content hash of the SPIR-V bytes (the vertex shader size first, so the boundary between the two counts)
+    uint64_t shaderCodeHash() {
+        uint64_t vertBytes = vertShaderCode.size() * sizeof(uint32_t);
+        ContentHash hash;
+        hash.update(&vertBytes, sizeof(vertBytes));
+        hash.update(vertShaderCode.data(), vertBytes);
+        hash.update(fragShaderCode.data(), fragShaderCode.size() * sizeof(uint32_t));
+        return hash.digest();
+    }
+
+    PipelineCacheFileHeader pipelineCacheHeader() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        PipelineCacheFileHeader header = {};
+        header.magic = PIPELINE_CACHE_MAGIC;
+        header.vendorID = properties.vendorID;
+        header.deviceID = properties.deviceID;
+        header.driverVersion = properties.driverVersion;
+        memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        header.shaderHash = shaderCodeHash();
+        return header;
+    }
+
+    // Embedded SPIR-V, or the external one when developing shaders (--spirv-dir)
+    std::vector<uint32_t> loadShaderCode(const char* filename, const uint32_t* embeddedCode, size_t embeddedWords) {
+        if (options.spirvDir.empty()) {
+            return std::vector<uint32_t>(embeddedCode, embeddedCode + embeddedWords);
+        }
+
+        std::string path = options.spirvDir + "/" + filename;
+        std::cout << "loading " << path << std::endl;
+        auto bytes = readFile(path);
+        if (bytes.size() % sizeof(uint32_t) != 0) {
+            throw std::runtime_error("failed to load shader, " + path + " is not SPIR-V!");
+        }
+        std::vector<uint32_t> code(bytes.size() / sizeof(uint32_t));
+        memcpy(code.data(), bytes.data(), bytes.size());
+        return code;
+    }
+
+    // Loading the shaders and seeding the pipeline cache with the data stored by the previous run, if it still matches
+    void createPipelineCache() {
+        vertShaderCode = loadShaderCode("vert.spv", vertShaderSpv, sizeof(vertShaderSpv) / sizeof(vertShaderSpv[0]));
+        fragShaderCode = loadShaderCode("frag.spv", fragShaderSpv, sizeof(fragShaderSpv) / sizeof(fragShaderSpv[0]));
+
+        std::vector<char> cacheData;
+        if (options.pipelineCache) {
+            std::ifstream file(PIPELINE_CACHE_FILE, std::ios::ate | std::ios::binary);
+            if (file.is_open()) {
+                size_t fileSize = (size_t) file.tellg();
+                PipelineCacheFileHeader header = {};
+                if (fileSize >= sizeof(header)) {
+                    file.seekg(0);
+                    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+                }
+                PipelineCacheFileHeader expected = pipelineCacheHeader();
+                expected.dataSize = header.dataSize;
+                if (fileSize == sizeof(header) + header.dataSize && memcmp(&header, &expected, sizeof(header)) == 0) {
+                    cacheData.resize(header.dataSize);
+                    file.read(cacheData.data(), header.dataSize);
+                    std::cout << "pipeline cache loaded (" << header.dataSize << " bytes)" << std::endl;
+                } else {
+                    std::cout << "pipeline cache discarded (different device, driver or shaders)" << std::endl;
+                }
+            } else {
+                std::cout << "no pipeline cache found" << std::endl;
+            }
+        }
+
+        VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+        pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        pipelineCacheCreateInfo.initialDataSize = cacheData.size();
+        pipelineCacheCreateInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+        std::cout << "...creating pipeline cache..." << std::endl;
+        VkResult res = vkCreatePipelineCache(logicalDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+        if (res != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+    }
+
+    // Storing the pipeline cache for the next run (written aside and renamed, so a crash never leaves a truncated cache)
+    void savePipelineCache() {
+        if (!options.pipelineCache) {
+            return;
+        }
+
+        size_t dataSize = 0;
+        vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, nullptr);
+        std::vector<char> cacheData(dataSize);
+        if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, cacheData.data()) != VK_SUCCESS) {
+            std::cout << "failed to read pipeline cache data" << std::endl;
+            return;
+        }
+
+        PipelineCacheFileHeader header = pipelineCacheHeader();
+        header.dataSize = static_cast<uint32_t>(dataSize);
+
+        std::string tmpFilename = std::string(PIPELINE_CACHE_FILE) + ".tmp";
+        std::ofstream file(tmpFilename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cout << "failed to write pipeline cache" << std::endl;
+            return;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(cacheData.data(), dataSize);
+        file.close();
+        if (!file || std::rename(tmpFilename.c_str(), PIPELINE_CACHE_FILE) != 0) {
+            std::cout << "failed to write pipeline cache" << std::endl;
+            return;
+        }
+        std::cout << "pipeline cache stored (" << dataSize << " bytes)" << std::endl;
+    }
+
     void createFramebuffers() {
         swapChainFramebuffers.resize(swapChainImageViews.size());
 
@@ -926,93 +3918,160 @@ private:
         VkCommandPoolCreateInfo commandPoolCreateInfo = {};
         commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-        //commandPoolCreateInfo.flags = 0;
+        commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // per-frame upload command buffers are re-recorded
 
         std::cout << "...creating command pool..." << std::endl;
         VkResult res = vkCreateCommandPool(logicalDevice, &commandPoolCreateInfo, nullptr, &commandPool);
         if (res != VK_SUCCESS) {
             throw std::runtime_error("failed to create command pool!");
         }
+
+        if (transferQueueDedicated) {
+            commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndices.transferFamily.value();
+
+            std::cout << "...creating transfer command pool..." << std::endl;
+            res = vkCreateCommandPool(logicalDevice, &commandPoolCreateInfo, nullptr, &transferCommandPool);
+            if (res != VK_SUCCESS) {
+                throw std::runtime_error("failed to create transfer command pool!");
+            }
+        }
     }
 
     // TODO: REFACTORING!!!
-    void createTextureImage(const char* uvMSFilename, const char* uvLSFilename) {
-        //loadTexture("textures/identityUVMS.png", uvMSTextureImage, uvMSTextureImageMemory);
-        int uvMSTexWidth, uvMSTexHeight, uvMSTexChannels;
-        //!!! Modify down here for changing warping effect
-        stbi_uc* uvMSPixels = stbi_load(uvMSFilename, &uvMSTexWidth, &uvMSTexHeight, &uvMSTexChannels, STBI_rgb_alpha);
-        VkDeviceSize uvMSImageSize = uvMSTexWidth * uvMSTexHeight * 4;
-
-        if (!uvMSPixels) {
-            //throw std::runtime_error(strcat(strcat("failed to load ", filename), "texture image!"));
-            throw std::runtime_error("failed to load uv MS texture image!");
+    void createTextureImage() {
+        if (options.warpMapFile.empty()) {
+            createWarpTextureImage();
+        } else {
+            createWarpTextureImageFromFile();
         }
 
-        VkBuffer uvMSStagingBuffer;
-        VkDeviceMemory uvMSStagingBufferMemory;
-        createBuffer(uvMSImageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     uvMSStagingBuffer, uvMSStagingBufferMemory);
-        
-        void* uvMSData;
-        vkMapMemory(logicalDevice, uvMSStagingBufferMemory, 0, uvMSImageSize, 0, &uvMSData);
-            memcpy(uvMSData ,uvMSPixels, static_cast<size_t>(uvMSImageSize));
-        vkUnmapMemory(logicalDevice, uvMSStagingBufferMemory);
+        //loadTexture("/home/eldomo/Desktop/domeCalibration1k3.jpg", colorTextureImage, colorTextureImageMemory);##############################################
+        createColorTextureImages();
+    }
 
-        stbi_image_free(uvMSPixels);
+    void createWarpTextureImage() {
+        // the MS/LS layers are recombined on the CPU (MS << 8 | LS), so the GPU filters the full 16-bit values
+        // instead of interpolating both bytes separately (wrong around carries)
+        loadWarpMap();
 
-        createImage(uvMSTexWidth, uvMSTexHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, uvMSTextureImage, uvMSTextureImageMemory);
-        
-        transitionImageLayout(uvMSTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-            copyBufferToImage(uvMSStagingBuffer, uvMSTextureImage, static_cast<uint32_t>(uvMSTexWidth), static_cast<uint32_t>(uvMSTexHeight));
-        transitionImageLayout(uvMSTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        warpTexFormat = options.floatWarpMap ? VK_FORMAT_R32G32_SFLOAT : VK_FORMAT_R16G16_UNORM;
+        size_t texelCount = warpMapWidth * warpMapHeight;
+        WarpMapLevel level = {};
+        level.size = texelCount * (options.floatWarpMap ? 2 * sizeof(float) : 2 * sizeof(uint16_t));
+        level.width = warpMapWidth;
+        level.height = warpMapHeight;
+        level.intensityOffset = level.size;
 
-        vkDestroyBuffer(logicalDevice, uvMSStagingBuffer, nullptr);
-        vkFreeMemory(logicalDevice, uvMSStagingBufferMemory, nullptr);
+        VkBuffer warpStagingBuffer;
+        MemoryAllocation warpStagingBufferMemory;
+        createBuffer(level.size + texelCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     warpStagingBuffer, warpStagingBufferMemory, ALLOCATION_LINEAR);
 
-        //loadTexture("textures/identityUVLS.png", uvLSTextureImage, uvLSTextureImageMemory);##################################################################
-        int uvLSTexWidth, uvLSTexHeight, uvLSTexChannels;
-        //!!! Modify down here for changing warping effect
-        stbi_uc* uvLSPixels = stbi_load(uvLSFilename, &uvLSTexWidth, &uvLSTexHeight, &uvLSTexChannels, STBI_rgb_alpha);
-        VkDeviceSize uvLSImageSize = uvLSTexWidth * uvLSTexHeight * 4;
+        uint8_t* staging = static_cast<uint8_t*>(warpStagingBufferMemory.mapped);
+        packWarpTexels(warpMap.data(), texelCount, options.floatWarpMap, staging, staging + level.intensityOffset);
 
-        if (!uvLSPixels) {
-            //throw std::runtime_error(strcat(strcat("failed to load ", filename), "texture image!"));
-            std::cout << uvLSFilename << std::endl;
-            throw std::runtime_error("failed to load uv LS texture image!");
-        }
+        // shared with the transfer queue when hot reloads may later update it in place
+        warpTexture = createWarpTexture(warpMapWidth, warpMapHeight, warpTexFormat, 1, options.watchWarpMap && transferQueueDedicated);
+        recordWarpTextureUpload(warpStagingBuffer, &level, 1);
 
-        VkBuffer uvLSStagingBuffer;
-        VkDeviceMemory uvLSStagingBufferMemory;
-        createBuffer(uvLSImageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     uvLSStagingBuffer, uvLSStagingBufferMemory);
-        
-        void* uvLSData;
-        vkMapMemory(logicalDevice, uvLSStagingBufferMemory, 0, uvLSImageSize, 0, &uvLSData);
-            memcpy(uvLSData, uvLSPixels, static_cast<size_t>(uvLSImageSize));
-        vkUnmapMemory(logicalDevice, uvLSStagingBufferMemory);
+        uploadBatchStagingBuffers.push_back({warpStagingBuffer, warpStagingBufferMemory});
+    }
 
-        stbi_image_free(uvLSPixels);
+    // The uv and intensity images of a warp map and their views (shared with the transfer queue when concurrent)
+    WarpTexture createWarpTexture(uint32_t width, uint32_t height, VkFormat uvFormat, uint32_t levels, bool concurrent) {
+        WarpTexture texture;
+        createImage(width, height, uvFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.uvImage, texture.uvMemory, concurrent, levels);
+        createImage(width, height, WARP_INTENSITY_FORMAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.intensityImage, texture.intensityMemory, concurrent, levels);
+        texture.uvView = createImageView(texture.uvImage, uvFormat, levels);
+        texture.intensityView = createImageView(texture.intensityImage, WARP_INTENSITY_FORMAT, levels);
+        return texture;
+    }
 
-        createImage(uvLSTexWidth, uvLSTexHeight, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, uvLSTextureImage, uvLSTextureImageMemory);
-        
-        transitionImageLayout(uvLSTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-            copyBufferToImage(uvLSStagingBuffer, uvLSTextureImage, static_cast<uint32_t>(uvLSTexWidth), static_cast<uint32_t>(uvLSTexHeight));
-        transitionImageLayout(uvLSTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    void destroyWarpTexture(WarpTexture texture) {
+        vkDestroyImageView(logicalDevice, texture.uvView, nullptr);
+        vkDestroyImage(logicalDevice, texture.uvImage, nullptr);
+        memoryAllocator.free(texture.uvMemory);
+        vkDestroyImageView(logicalDevice, texture.intensityView, nullptr);
+        vkDestroyImage(logicalDevice, texture.intensityImage, nullptr);
+        memoryAllocator.free(texture.intensityMemory);
+    }
+
+    // Uploading the uv and intensity planes of every level (offsets into buffer) into warpTexture, in the upload batch
+    void recordWarpTextureUpload(VkBuffer buffer, const WarpMapLevel* levels, uint32_t levelCount) {
+        for (bool intensity : {false, true}) {
+            VkImage image = intensity ? warpTexture.intensityImage : warpTexture.uvImage;
+            VkFormat format = intensity ? WARP_INTENSITY_FORMAT : warpTexFormat;
+            transitionImageLayout(uploadBatchCommandBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levelCount);
+            for (uint32_t level = 0; level < levelCount; level++) {
+                copyBufferToImage(uploadBatchCommandBuffer, buffer, image, levels[level].width, levels[level].height,
+                                  intensity ? levels[level].intensityOffset : levels[level].offset, level);
+            }
+            transitionImageLayout(uploadBatchCommandBuffer, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, levelCount);
+        }
+    }
+
+    // Uploading a precomputed .vwm warp map (WarpMapFormat.h) and its mip levels straight from the file mapping:
+    // the texels are already in the texture format, so the file is only checksummed and copied into the staging buffer
+    void createWarpTextureImageFromFile() {
+        if (options.floatWarpMap) {
+            std::cout << "--float-warp-map ignored, the precision comes from the warp map file" << std::endl;
+        }
+        MappedFile file(options.warpMapFile, "failed to open warp map file!");
+        WarpMapHeader header = readWarpMapHeader(file);
+        uint32_t texelSize = warpMapTexelSize(header.precision);
+        warpTexFormat = warpMapFormat(header.precision);
+        warpMapWidth = header.width;
+        warpMapHeight = header.height;
+        warpMapLevels = header.levelCount;
+
+        VkBuffer warpStagingBuffer;
+        MemoryAllocation warpStagingBufferMemory;
+        createBuffer(header.dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     warpStagingBuffer, warpStagingBufferMemory, ALLOCATION_LINEAR);
+        uploadBatchStagingBuffers.push_back({warpStagingBuffer, warpStagingBufferMemory});
+
+        // checksummed chunk by chunk right before copying it, so the file is only read once
+        const size_t chunkSize = 1 << 20;
+        const uint8_t* data = file.data() + sizeof(header);
+        uint8_t* staging = static_cast<uint8_t*>(warpStagingBufferMemory.mapped);
+        ContentHash checksum;
+        for (size_t offset = 0; offset < header.dataSize; offset += chunkSize) {
+            size_t size = std::min<size_t>(chunkSize, header.dataSize - offset);
+            checksum.update(data + offset, size);
+            memcpy(staging + offset, data + offset, size);
+        }
+        if (checksum.digest() != header.checksum) {
+            throw std::runtime_error("warp map file checksum mismatch!");
+        }
 
-        vkDestroyBuffer(logicalDevice, uvLSStagingBuffer, nullptr);
-        vkFreeMemory(logicalDevice, uvLSStagingBufferMemory, nullptr);
+        // the CPU copy (tile dependency index) is read back from level 0
+        warpMap.resize(3 * size_t(warpMapWidth) * warpMapHeight);
+        const uint8_t* level0 = data + header.levels[0].offset;
+        const uint8_t* intensity0 = data + header.levels[0].intensityOffset;
+        for (size_t i = 0; i < size_t(warpMapWidth) * warpMapHeight; i++) {
+            warpMapTexelToUnorm16(level0 + i * texelSize, intensity0[i], header.precision, &warpMap[3 * i]);
+        }
 
-        //loadTexture("/home/eldomo/Desktop/domeCalibration1k3.jpg", colorTextureImage, colorTextureImageMemory);##############################################
+        warpTexture = createWarpTexture(warpMapWidth, warpMapHeight, warpTexFormat, warpMapLevels, options.watchWarpMap && transferQueueDedicated);
+        recordWarpTextureUpload(warpStagingBuffer, header.levels, warpMapLevels);
+        std::cout << "warp map loaded from " << options.warpMapFile << " (" << warpMapLevels << " mip levels)" << std::endl;
+    }
+
+    void createColorTextureImages() {
         int colorTexWidth, colorTexHeight, colorTexChannels;
         //VkFormat format;
         stbi_uc* colorPixels;
+        StagingSlice colorStaging; // one staging slice seeds every color texture (the upload batch completes before the first frame reuses the ring)
         //!!! Modify down here for changing warping effect
         if (capture) {
             std::cout << "...screen capture..." << std::endl;
             #if __linux__
-                screenCapture = XGetImage(display, root_window, 420, 0, HEIGHT, HEIGHT, AllPlanes, ZPixmap);
+                screenCapture = grabScreen(captureFrames.frontSlot());
+                hashCaptureTiles(captureSlots[captureFrames.frontSlot()]);
+                colorTextureTileHashes.assign(MAX_FRAMES_IN_FLIGHT, captureSlots[captureFrames.frontSlot()].tileHashes);
+                displayedTileHashes = captureSlots[captureFrames.frontSlot()].tileHashes;
                 std::cout << "Screen Capture Initialised!" << std::endl;
                 colorTexWidth = screenCapture->width;
                 colorTexHeight = screenCapture->height;
@@ -1021,42 +4080,120 @@ private:
                 colorTexFormat = VK_FORMAT_B8G8R8A8_UNORM;
             #endif
         } else {
-            colorPixels = stbi_load("/home/eldomo/Desktop/domeCalibration1k3.jpg", &colorTexWidth, &colorTexHeight, &colorTexChannels, STBI_rgb_alpha);
+            // decoded straight into the staging slice, see startColorDecode
+            waitForDecode(colorDecode);
+            colorTexWidth = colorTextureWidth;
+            colorTexHeight = colorTextureHeight;
+            colorTexChannels = 4;
+            colorStaging = colorDecodeStaging;
             colorTexFormat = VK_FORMAT_R8G8B8A8_UNORM;
         }
         VkDeviceSize colorImageSize = colorTexWidth * colorTexHeight * 4;
+        colorTextureWidth = colorTexWidth;
+        colorTextureHeight = colorTexHeight;
+        if (capture) {
+            colorStaging = allocateStaging(0, colorImageSize);
+            memcpy(colorStaging.data, colorPixels, static_cast<size_t>(colorImageSize));
+        }
 
-        if (!colorPixels) {
-            throw std::runtime_error("failed to load colour texture image!");
+        colorTextureImages.resize(MAX_FRAMES_IN_FLIGHT);
+        colorTextureImagesMemory.resize(MAX_FRAMES_IN_FLIGHT);
+        colorTextureSerials.assign(MAX_FRAMES_IN_FLIGHT, latestCaptureSerial);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            // partially updated on the transfer queue and sampled on the graphics queue, shared to keep the untouched tiles
+            createImage(colorTexWidth, colorTexHeight, colorTexFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorTextureImages[i], colorTextureImagesMemory[i], capture && transferQueueDedicated);
         }
 
-        //VkBuffer colorStagingBuffer;
-        //VkDeviceMemory colorStagingBufferMemory;
-        createBuffer(colorImageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                    colorStagingBuffer, colorStagingBufferMemory);
-        
-        void* colorData;
-        vkMapMemory(logicalDevice, colorStagingBufferMemory, 0, colorImageSize, 0, &colorData);
-            memcpy(colorData, colorPixels, static_cast<size_t>(colorImageSize));
-        vkUnmapMemory(logicalDevice, colorStagingBufferMemory);
 
-        stbi_image_free(colorPixels);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            transitionImageLayout(uploadBatchCommandBuffer, colorTextureImages[i], colorTexFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+                copyBufferToImage(uploadBatchCommandBuffer, colorStaging.buffer, colorTextureImages[i], static_cast<uint32_t>(colorTexWidth), static_cast<uint32_t>(colorTexHeight),
+                                  colorStaging.offset);
+            transitionImageLayout(uploadBatchCommandBuffer, colorTextureImages[i], colorTexFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        }
+    }
+
+    // Starting to decode every image file on the worker pool, while the window and the Vulkan objects are created
+    void startImageDecodes(const char* uvMSFilename, const char* uvLSFilename) {
+        if (options.textureCache) {
+            textureCache.init(options.textureCacheDir, options.textureCacheMaxBytes);
+        }
+        TextureCache* cache = &textureCache;
+        std::string msFilename = uvMSFilename, lsFilename = uvLSFilename;
+        if (options.warpMapFile.empty()) {
+            // a .vwm warp map needs no decoding, it is mapped when the warp texture is created
+            uvMSDecode = workerPool.submit([msFilename, cache]() {
+                return cache->enabled() ? decodeImageCached(msFilename, "failed to load uv MS texture image!", *cache)
+                                        : decodeImage(msFilename, "failed to load uv MS texture image!");
+            });
+            uvLSDecode = workerPool.submit([lsFilename, cache]() {
+                return cache->enabled() ? decodeImageCached(lsFilename, "failed to load uv LS texture image!", *cache)
+                                        : decodeImage(lsFilename, "failed to load uv LS texture image!");
+            });
+        }
+        if (!capture) {
+            // only read and probed here (and looked up in the texture cache), decoded once its staging memory exists (startColorDecode)
+            std::string colorImageFile = options.colorImageFile;
+            colorFileRead = workerPool.submit([colorImageFile, cache]() {
+                EncodedImage encoded = readImageFile(colorImageFile, "failed to load colour texture image!");
+                if (cache->enabled()) {
+                    encoded.cacheKey = TextureCache::key(encoded.bytes, TEXTURE_CACHE_FORMAT_RGBA8);
+                    encoded.cached = cache->find(encoded.cacheKey, encoded.bytes, encoded.width, encoded.height);
+                }
+                return encoded;
+            });
+        }
+    }
 
-        createImage(colorTexWidth, colorTexHeight, colorTexFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorTextureImage, colorTextureImageMemory);
-        
-        transitionImageLayout(colorTextureImage, colorTexFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-            copyBufferToImage(colorStagingBuffer, colorTextureImage, static_cast<uint32_t>(colorTexWidth), static_cast<uint32_t>(colorTexHeight));
-        transitionImageLayout(colorTextureImage, colorTexFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Decoding the color image straight into a slice of the first staging ring, while the rest of the initialisation goes on
+    void startColorDecode() {
+        if (capture) {
+            return;
+        }
+        auto encoded = std::make_shared<EncodedImage>(waitForDecode(colorFileRead));
+        colorTextureWidth = encoded->width;
+        colorTextureHeight = encoded->height;
+        colorDecodeStaging = allocateStaging(0, VkDeviceSize(encoded->width) * encoded->height * 4);
+        uint8_t* dst = colorDecodeStaging.data;
+        TextureCache* cache = &textureCache;
+        colorDecode = workerPool.submit([encoded, dst, cache]() {
+            size_t size = size_t(encoded->width) * encoded->height * 4;
+            if (encoded->cached) {
+                // the mapped entry is read once, straight into the staging slice
+                memcpy(dst, encoded->cached->data() + sizeof(TextureCacheHeader), size);
+                return;
+            }
+            decodeImageInto(*encoded, dst, "failed to load colour texture image!");
+            if (cache->enabled()) {
+                cache->store(encoded->cacheKey, encoded->bytes, encoded->width, encoded->height, dst); // written from the staging slice
+            }
+        });
+    }
+
+    // Result of a decode started by startImageDecodes, the time spent blocked on it is what the overlap did not hide
+    template <typename T>
+    T waitForDecode(std::future<T>& decode) {
+        auto waitStart = std::chrono::steady_clock::now();
+        decode.wait();
+        decodeWaitMicros += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - waitStart).count();
+        return decode.get();
+    }
 
-        //vkDestroyBuffer(logicalDevice, colorStagingBuffer, nullptr);
-        //vkFreeMemory(logicalDevice, colorStagingBufferMemory, nullptr);
+    // Recombining the decoded 8-bit MS/LS warp map pair into warpMap (16-bit u, v, intensity per texel)
+    void loadWarpMap() {
+        DecodedImage uvMS = waitForDecode(uvMSDecode);
+        DecodedImage uvLS = waitForDecode(uvLSDecode);
+        combineWarpMapPair(uvMS, uvLS, warpMap);
+        warpMapWidth = uvMS.width;
+        warpMapHeight = uvMS.height;
     }
 
     void createTextureImageView() {
-        uvMSTextureImageView = createImageView(uvMSTextureImage, VK_FORMAT_R8G8B8A8_UNORM);
-        uvLSTextureImageView = createImageView(uvLSTextureImage, VK_FORMAT_R8G8B8A8_UNORM);
-        colorTextureImageView = createImageView(colorTextureImage, colorTexFormat);
+        colorTextureImageViews.resize(MAX_FRAMES_IN_FLIGHT);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            colorTextureImageViews[i] = createImageView(colorTextureImages[i], colorTexFormat);
+        }
     }
 
     void createTextureSampler() {
@@ -1083,9 +4220,32 @@ private:
         if (res != VK_SUCCESS){
             throw std::runtime_error("failed to create texture sampler!");
         }
+
+        // the warp map is clamped (no bleeding between opposite borders) and filtered linearly only where the uv format allows it
+        // (linear filtering of 32-bit float textures is optional, the R8 intensity image shares the sampler)
+        VkFormatProperties warpFormatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, warpTexFormat, &warpFormatProperties);
+        VkFilter warpFilter = VK_FILTER_LINEAR;
+        if (!(warpFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+            std::cout << "linear filtering not supported for the warp map format, using nearest filtering" << std::endl;
+            warpFilter = VK_FILTER_NEAREST;
+        }
+        samplerCreateInfo.magFilter = warpFilter;
+        samplerCreateInfo.minFilter = warpFilter;
+        samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        // the levels are limited by the view (precomputed mips of a .vwm warp map), --validate samples level 0 like the CPU warp
+        samplerCreateInfo.maxLod = options.validate ? 0.0f : VK_LOD_CLAMP_NONE;
+
+        std::cout << "...creating the warp map sampler..." << std::endl;
+        res = vkCreateSampler(logicalDevice, &samplerCreateInfo, nullptr, &warpSampler);
+        if (res != VK_SUCCESS){
+            throw std::runtime_error("failed to create warp map sampler!");
+        }
     }
 
-    VkImageView createImageView(VkImage image, VkFormat format) {
+    VkImageView createImageView(VkImage image, VkFormat format, uint32_t mipLevels = 1) {
         VkImageViewCreateInfo ivCreateInfo = {};
         ivCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
         ivCreateInfo.image = image;
@@ -1093,7 +4253,7 @@ private:
         ivCreateInfo.format = format;
         ivCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         ivCreateInfo.subresourceRange.baseMipLevel = 0;
-        ivCreateInfo.subresourceRange.levelCount = 1;
+        ivCreateInfo.subresourceRange.levelCount = mipLevels;
         ivCreateInfo.subresourceRange.baseArrayLayer = 0;
         ivCreateInfo.subresourceRange.layerCount = 1;
 
@@ -1108,14 +4268,14 @@ private:
     }
 
     void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
-                     VkImage& image, VkDeviceMemory& imageMemory) {
+                     VkImage& image, MemoryAllocation& imageMemory, bool sharedWithTransferQueue = false, uint32_t mipLevels = 1) {
         VkImageCreateInfo imageCreateInfo = {};
         imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
         imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
         imageCreateInfo.extent.width = width;
         imageCreateInfo.extent.height = height;
         imageCreateInfo.extent.depth = 1;
-        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.mipLevels = mipLevels;
         imageCreateInfo.arrayLayers = 1;
         imageCreateInfo.format = format;
         imageCreateInfo.tiling = tiling;
@@ -1124,6 +4284,12 @@ private:
         imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
         //imageCreateInfo.flags = 0;
         imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        uint32_t queueFamilyIndices[] = {deviceQueueFamilies.graphicsFamily.value(), deviceQueueFamilies.transferFamily.value_or(0)};
+        if (sharedWithTransferQueue) {
+            imageCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT; // no ownership transfers between the two queues
+            imageCreateInfo.queueFamilyIndexCount = 2;
+            imageCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+        }
 
         std::cout << "...creating image..." << std::endl;
         VkResult res = vkCreateImage(logicalDevice, &imageCreateInfo, nullptr, &image);
@@ -1134,23 +4300,13 @@ private:
         VkMemoryRequirements memRequirements;
         vkGetImageMemoryRequirements(logicalDevice, image, &memRequirements);
 
-        VkMemoryAllocateInfo memAllocInfo = {};
-        memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        memAllocInfo.allocationSize = memRequirements.size;
-        memAllocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-        std::cout << "...allocating memory for texture..." << std::endl;
-        res = vkAllocateMemory(logicalDevice, &memAllocInfo, nullptr, &imageMemory);
-        if (res != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate memory!");
-        }
-
-        vkBindImageMemory(logicalDevice, image, imageMemory, 0);
+        imageMemory = memoryAllocator.allocate(memRequirements, findMemoryType(memRequirements.memoryTypeBits, properties), ALLOCATION_BUDDY);
+        vkBindImageMemory(logicalDevice, image, imageMemory.memory, imageMemory.offset);
     }
 
-    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
+    // Recording a layout transition into commandBuffer (submitted later together with the rest of the uploads)
+    void transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout,
+                               uint32_t mipLevels = 1) {
         VkImageMemoryBarrier barrier = {};
         barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
         barrier.oldLayout = oldLayout;
@@ -1160,7 +4316,7 @@ private:
         barrier.image = image;
         barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.levelCount = mipLevels;
         barrier.subresourceRange.baseArrayLayer = 0;
         barrier.subresourceRange.layerCount = 1;
 
@@ -1173,6 +4329,13 @@ private:
             
             srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
             dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        } else if (oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+            // re-uploading a texture sampled by previously submitted frames: wait for their fragment shaders
+            barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+            srcStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
         } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
             barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
             barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
@@ -1184,27 +4347,61 @@ private:
         }
 
         vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    void createStagingRings() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        // texel-aligned for every streamed format (4 and 16 bytes), and at the preferred copy alignment
+        stagingAlignment = std::max<VkDeviceSize>(16, properties.limits.optimalBufferCopyOffsetAlignment);
 
-        endSingleTimeCommands(commandBuffer);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            stagingRings[i].size = STAGING_RING_SIZE;
+            createBuffer(stagingRings[i].size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         stagingRings[i].buffer, stagingRings[i].memory);
+        }
     }
 
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    // Carving an aligned slice out of the frame's staging ring. A full ring is replaced by one twice as large,
+    // the old buffer is kept alive for the slices already recorded in this frame (deferred deletion)
+    StagingSlice allocateStaging(size_t frame, VkDeviceSize size) {
+        StagingRing& ring = stagingRings[frame];
+        VkDeviceSize offset = (ring.head + stagingAlignment - 1) / stagingAlignment * stagingAlignment;
+        if (offset + size > ring.size) {
+            VkBuffer oldBuffer = ring.buffer;
+            MemoryAllocation oldMemory = ring.memory;
+            deletionQueue.push_back({submittedFrames + 1, [this, oldBuffer, oldMemory]() mutable {
+                vkDestroyBuffer(logicalDevice, oldBuffer, nullptr);
+                memoryAllocator.free(oldMemory);
+            }});
+
+            while (ring.size < size) {
+                ring.size *= 2;
+            }
+            ring.size *= 2;
+            std::cout << "...growing staging ring " << frame << " to " << ring.size << " bytes..." << std::endl;
+            createBuffer(ring.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         ring.buffer, ring.memory);
+            offset = 0;
+        }
+        ring.head = offset + size;
+        return {ring.buffer, offset, static_cast<uint8_t*>(ring.memory.mapped) + offset};
+    }
 
+    void copyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, VkDeviceSize bufferOffset = 0,
+                           uint32_t mipLevel = 0) {
         VkBufferImageCopy region = {};
-        region.bufferOffset = 0;
+        region.bufferOffset = bufferOffset;
         region.bufferRowLength = 0;
         region.bufferImageHeight = 0;
         region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.mipLevel = mipLevel;
         region.imageSubresource.baseArrayLayer = 0;
         region.imageSubresource.layerCount = 1;
         region.imageOffset = {0, 0, 0};
         region.imageExtent = {width, height, 1};
 
         vkCmdCopyBufferToImage(commandBuffer, buffer ,image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-        endSingleTimeCommands(commandBuffer);
     }
 
     void createVertexBuffer(const std::vector<Vertex> vertices) {
@@ -1212,70 +4409,181 @@ private:
         std::cout << bufferSize << std::endl;
         
         VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
+        MemoryAllocation stagingBufferMemory;
         createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, ALLOCATION_LINEAR);
 
-        void* data;
-        vkMapMemory(logicalDevice, stagingBufferMemory ,0, bufferSize, 0, &data);
-            memcpy(data, vertices.data(), (size_t) bufferSize);
-        vkUnmapMemory(logicalDevice, stagingBufferMemory);
+        memcpy(stagingBufferMemory.mapped, vertices.data(), (size_t) bufferSize);
 
         createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
-        copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+        copyBuffer(uploadBatchCommandBuffer, stagingBuffer, vertexBuffer, bufferSize);
 
-        vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-        vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+        uploadBatchStagingBuffers.push_back({stagingBuffer, stagingBufferMemory});
     }
 
-    void createIndexBuffer() {
-        VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    void createIndexBuffer(const std::vector<uint32_t>& meshIndices, size_t vertexCount) {
+        drawIndexType = indexTypeFor(vertexCount);
+        VkDeviceSize bufferSize = indexSize(drawIndexType) * meshIndices.size();
         
         VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
+        MemoryAllocation stagingBufferMemory;
         createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, ALLOCATION_LINEAR);
+
+        writeIndices(meshIndices, drawIndexType, stagingBufferMemory.mapped);
+
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+        copyBuffer(uploadBatchCommandBuffer, stagingBuffer, indexBuffer, bufferSize);
+
+        uploadBatchStagingBuffers.push_back({stagingBuffer, stagingBufferMemory});
+        drawIndexCount = static_cast<uint32_t>(meshIndices.size());
+    }
+
+    // 16-bit indices while the mesh allows it (half the index fetches), 32-bit for large fitted meshes
+    static VkIndexType indexTypeFor(size_t vertexCount) {
+        return vertexCount <= size_t(std::numeric_limits<uint16_t>::max()) + 1 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    }
+
+    static VkDeviceSize indexSize(VkIndexType type) {
+        return type == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+    }
+
+    static void writeIndices(const std::vector<uint32_t>& meshIndices, VkIndexType type, void* dst) {
+        if (type == VK_INDEX_TYPE_UINT32) {
+            memcpy(dst, meshIndices.data(), meshIndices.size() * sizeof(uint32_t));
+            return;
+        }
+        uint16_t* narrow = static_cast<uint16_t*>(dst);
+        for (size_t i = 0; i < meshIndices.size(); i++) {
+            narrow[i] = static_cast<uint16_t>(meshIndices[i]);
+        }
+    }
+
+    // Pixels where the warp map intensity is zero are black whatever the color texture holds, unless the intensity is ignored
+    // or the warp map is not read at all. A fitted mesh (--mesh-warp) drops its black triangles itself.
+    bool coverageMeshEnabled() const {
+        return options.coverageMesh && !options.meshWarp && options.applyIntensity
+               && (options.warpMode == WARP_MODE_16BIT || options.warpMode == WARP_MODE_8BIT);
+    }
+
+    WarpMesh buildMeshWarp(const std::vector<uint16_t>& uvi, uint32_t width, uint32_t height) const {
+        return buildWarpMesh(uvi, width, height, (*quadVertices)[0].pos, (*quadVertices)[2].pos, colorTextureWidth, colorTextureHeight,
+                             options.meshWarpMaxError, options.applyIntensity);
+    }
+
+    void reportMeshWarp(const WarpMesh& mesh) const {
+        std::cout << "mesh warp: " << mesh.vertices.size() << " vertices, " << mesh.indices.size() / 3 << " triangles ("
+                  << (indexTypeFor(mesh.vertices.size()) == VK_INDEX_TYPE_UINT32 ? "32" : "16") << "-bit indices), error under "
+                  << options.meshWarpMaxError << " pixels" << std::endl;
+    }
 
-        void* data;
-        vkMapMemory(logicalDevice, stagingBufferMemory ,0, bufferSize, 0, &data);
-            memcpy(data, indices.data(), (size_t) bufferSize);
-        vkUnmapMemory(logicalDevice, stagingBufferMemory);
+    // Geometry drawn every frame: the mesh fitted to the warp map with --mesh-warp, otherwise the quad, clipped to the
+    // coverage polygon of the warp map (a triangle fan) so that the pixels which are always black are left to the render
+    // pass clear instead of being shaded
+    void buildDrawMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& meshIndices) {
+        if (options.meshWarp) {
+            WarpMesh mesh = buildMeshWarp(warpMap, warpMapWidth, warpMapHeight);
+            reportMeshWarp(mesh);
+            vertices.swap(mesh.vertices);
+            meshIndices.swap(mesh.indices);
+            if (meshIndices.empty()) {
+                // black warp map: a degenerate triangle, the buffers cannot be empty
+                vertices = {(*quadVertices)[0]};
+                meshIndices = {0, 0, 0};
+            }
+            return;
+        }
+        vertices = *quadVertices;
+        meshIndices.assign(indices.begin(), indices.end());
+        if (!coverageMeshEnabled()) {
+            return;
+        }
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
-        copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+        glm::vec2 quadMin = (*quadVertices)[0].pos; // texCoord (0, 0)
+        glm::vec2 quadMax = (*quadVertices)[2].pos; // texCoord (1, 1)
+        // bilinear filtering reaches half a texel past the lit texels. A minified map with mips is read from up to level
+        // ceil(log2(texels per pixel)), each texel of which is the box filter of 2^level x 2^level texels of level 0.
+        float texelsPerPixel = std::max(warpMapWidth / ((quadMax.x - quadMin.x) * 0.5f * swapChainExtent.width),
+                                        warpMapHeight / ((quadMax.y - quadMin.y) * 0.5f * swapChainExtent.height));
+        uint32_t level = 0;
+        if (warpMapLevels > 1 && texelsPerPixel > 1.0f) {
+            level = std::min(static_cast<uint32_t>(std::ceil(std::log2(texelsPerPixel))), warpMapLevels - 1);
+        }
+        int64_t margin = (int64_t(3) << level) / 2 + 1; // plus one texel against rounding in the rasterizer and the sampler
+        std::vector<glm::vec2> polygon = warpCoveragePolygon(warpMap, warpMapWidth, warpMapHeight, margin);
+
+        vertices.clear();
+        meshIndices.clear();
+        float area = 0.0f; // fraction of the quad covered
+        for (size_t i = 0; i < polygon.size(); i++) {
+            const glm::vec2& a = polygon[i];
+            const glm::vec2& b = polygon[(i + 1) % polygon.size()];
+            area += 0.5f * (a.x * b.y - b.x * a.y);
+            vertices.push_back({quadMin + a * (quadMax - quadMin), {1.0f, 1.0f, 1.0f}, a});
+            if (i >= 2) {
+                // same winding as the quad (front faces are clockwise on screen)
+                meshIndices.insert(meshIndices.end(), {0, static_cast<uint32_t>(i - 1), static_cast<uint32_t>(i)});
+            }
+        }
+        if (meshIndices.empty()) {
+            // black warp map: a degenerate triangle, the buffers cannot be empty
+            vertices = {(*quadVertices)[0]};
+            meshIndices = {0, 0, 0};
+        }
+        std::cout << "coverage mesh: " << polygon.size() << " vertices, " << area * 100.0f << "% of the quad shaded" << std::endl;
+    }
 
-        vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-        vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+    // Replacing the draw mesh for a new warp map or output size. The new buffers are host visible and written directly,
+    // so that no upload has to be waited for; the previous ones are destroyed once the frames drawing them have completed.
+    void replaceDrawMesh(const std::vector<Vertex>& meshVertices, const std::vector<uint32_t>& meshIndices) {
+        VkBuffer oldVertexBuffer = vertexBuffer, oldIndexBuffer = indexBuffer;
+        MemoryAllocation oldVertexBufferMemory = vertexBufferMemory, oldIndexBufferMemory = indexBufferMemory;
+        deletionQueue.push_back({submittedFrames, [this, oldVertexBuffer, oldIndexBuffer, oldVertexBufferMemory, oldIndexBufferMemory]() mutable {
+            vkDestroyBuffer(logicalDevice, oldVertexBuffer, nullptr);
+            memoryAllocator.free(oldVertexBufferMemory);
+            vkDestroyBuffer(logicalDevice, oldIndexBuffer, nullptr);
+            memoryAllocator.free(oldIndexBufferMemory);
+        }});
+
+        drawIndexType = indexTypeFor(meshVertices.size());
+        VkDeviceSize vertexBufferSize = sizeof(meshVertices[0]) * meshVertices.size();
+        VkDeviceSize indexBufferSize = indexSize(drawIndexType) * meshIndices.size();
+        createBuffer(vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     vertexBuffer, vertexBufferMemory);
+        memcpy(vertexBufferMemory.mapped, meshVertices.data(), (size_t) vertexBufferSize);
+        createBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     indexBuffer, indexBufferMemory);
+        writeIndices(meshIndices, drawIndexType, indexBufferMemory.mapped);
+        drawIndexCount = static_cast<uint32_t>(meshIndices.size());
     }
 
     void createUniformBuffer() {
         VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-        uniformBuffers.resize(swapChainImages.size());
-        uniformBuffersMemory.resize(swapChainImages.size());
+        uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+        uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
 
-        for (size_t i = 0; i < swapChainImages.size(); i++) {
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
             createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                          uniformBuffers[i], uniformBuffersMemory[i]);
         }
     }
 
     void createDescriptorPool() {
-        std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+        // one set per frame in flight, each with a uniform buffer and three combined image samplers (warp uv, color, warp intensity)
+        std::array<VkDescriptorPoolSize, 2> poolSizes = {};
         poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[0].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
+        poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
         poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[1].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
-        poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[2].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
+        poolSizes[1].descriptorCount = static_cast<uint32_t>(3 * MAX_FRAMES_IN_FLIGHT);
 
         VkDescriptorPoolCreateInfo poolCreateInfo = {};
         poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
         poolCreateInfo.pPoolSizes = poolSizes.data();
-        poolCreateInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());
+        poolCreateInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
         std::cout << "...creating descriptor pool..." << std::endl;
         VkResult res = vkCreateDescriptorPool(logicalDevice, &poolCreateInfo, nullptr, &descriptorPool);
@@ -1285,42 +4593,42 @@ private:
     }
 
     void createDescriptorSets() {
-        std::vector<VkDescriptorSetLayout>layouts(swapChainImages.size(), descriptorSetLayout);
+        std::vector<VkDescriptorSetLayout>layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
         VkDescriptorSetAllocateInfo allocInfo = {};
         allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         allocInfo.descriptorPool = descriptorPool;
-        allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
         allocInfo.pSetLayouts = layouts.data();
 
-        descriptorSets.resize(swapChainImages.size());
+        descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
         std::cout << "allocating descriptor sets..." << std::endl;
         VkResult res = vkAllocateDescriptorSets(logicalDevice, &allocInfo, &descriptorSets[0]);
         if (res != VK_SUCCESS) {
             throw std::runtime_error("failed to allocate descriptor sets!");
         }
 
-        for (size_t i = 0; i < swapChainImages.size(); i++) {
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
             VkDescriptorBufferInfo descriptorBufferInfo = {};
             descriptorBufferInfo.buffer = uniformBuffers[i];
             descriptorBufferInfo.offset = 0;
             descriptorBufferInfo.range = sizeof(UniformBufferObject);
 
-            VkDescriptorImageInfo descriptorUVMSImageInfo = {};
-            descriptorUVMSImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            descriptorUVMSImageInfo.imageView = uvMSTextureImageView;
-            descriptorUVMSImageInfo.sampler = textureSampler;
+            VkDescriptorImageInfo descriptorWarpImageInfo = {};
+            descriptorWarpImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            descriptorWarpImageInfo.imageView = warpTexture.uvView;
+            descriptorWarpImageInfo.sampler = warpSampler;
 
-            VkDescriptorImageInfo descriptorUVLSImageInfo = {};
-            descriptorUVLSImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            descriptorUVLSImageInfo.imageView = uvLSTextureImageView;
-            descriptorUVLSImageInfo.sampler = textureSampler;
+            VkDescriptorImageInfo descriptorIntensityImageInfo = {};
+            descriptorIntensityImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            descriptorIntensityImageInfo.imageView = warpTexture.intensityView;
+            descriptorIntensityImageInfo.sampler = warpSampler;
             
             //VkDescriptorImageInfo descriptorColorImageInfo = {};
             descriptorColorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            descriptorColorImageInfo.imageView = colorTextureImageView;
+            descriptorColorImageInfo.imageView = colorTextureImageViews[i];
             descriptorColorImageInfo.sampler = textureSampler;
 
-            //std::array<VkWriteDescriptorSet, 4> writeDescriptorSets = {};
+            //std::array<VkWriteDescriptorSet, 3> writeDescriptorSets = {};
             
             writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             writeDescriptorSets[0].dstSet = descriptorSets[i];
@@ -1339,7 +4647,7 @@ private:
             writeDescriptorSets[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
             writeDescriptorSets[1].descriptorCount = 1;
             //writeDescriptorSets[1].pBufferInfo = &descriptorBufferInfo;
-            writeDescriptorSets[1].pImageInfo = &descriptorUVMSImageInfo;
+            writeDescriptorSets[1].pImageInfo = &descriptorWarpImageInfo;
             //writeDescriptorSets[1].pTexelBufferView = nullptr;
 
             writeDescriptorSets[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -1349,7 +4657,7 @@ private:
             writeDescriptorSets[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
             writeDescriptorSets[2].descriptorCount = 1;
             //writeDescriptorSets[2].pBufferInfo = &descriptorBufferInfo;
-            writeDescriptorSets[2].pImageInfo = &descriptorUVLSImageInfo;
+            writeDescriptorSets[2].pImageInfo = &descriptorColorImageInfo;
             //writeDescriptorSets[2].pTexelBufferView = nullptr;
 
             writeDescriptorSets[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -1358,15 +4666,14 @@ private:
             writeDescriptorSets[3].dstArrayElement = 0;
             writeDescriptorSets[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
             writeDescriptorSets[3].descriptorCount = 1;
-            //writeDescriptorSets[3].pBufferInfo = &descriptorBufferInfo;
-            writeDescriptorSets[3].pImageInfo = &descriptorColorImageInfo;
-            //writeDescriptorSets[3].pTexelBufferView = nullptr;
+            writeDescriptorSets[3].pImageInfo = &descriptorIntensityImageInfo;
 
             vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
         }
     }
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory,
+                      AllocationStrategy strategy = ALLOCATION_BUDDY) {
         VkBufferCreateInfo bufferCreateInfo = {};
         bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         bufferCreateInfo.size = size;
@@ -1379,260 +4686,1026 @@ private:
             throw std::runtime_error("failed to create vertex buffer!");
         }
 
-        VkMemoryRequirements memoryRequirements;
-        vkGetBufferMemoryRequirements(logicalDevice, buffer, &memoryRequirements);
+        VkMemoryRequirements memoryRequirements;
+        vkGetBufferMemoryRequirements(logicalDevice, buffer, &memoryRequirements);
+
+        bufferMemory = memoryAllocator.allocate(memoryRequirements, findMemoryType(memoryRequirements.memoryTypeBits, properties), strategy);
+        vkBindBufferMemory(logicalDevice, buffer, bufferMemory.memory, bufferMemory.offset);
+    }
+
+    VkCommandBuffer beginSingleTimeCommands() {
+        VkCommandBufferAllocateInfo bufferAllocateInfo = {};
+        bufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        bufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        bufferAllocateInfo.commandPool = commandPool;
+        bufferAllocateInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        vkAllocateCommandBuffers(logicalDevice, &bufferAllocateInfo, &commandBuffer);
+
+        VkCommandBufferBeginInfo commandBufferBeginInfo = {};
+        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(commandBuffer ,&commandBufferBeginInfo);
+
+        return commandBuffer;
+    }
+
+    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+        vkEndCommandBuffer(commandBuffer);
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        // waiting on a fence only for this submission instead of draining the whole queue
+        VkFenceCreateInfo fenceCreateInfo = {};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        VkFence fence;
+        if (vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload fence!");
+        }
+
+        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit upload command buffer!");
+        }
+        vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+
+        vkDestroyFence(logicalDevice, fence, nullptr);
+        vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
+    }
+
+    void beginUploadBatch() {
+        uploadBatchCommandBuffer = beginSingleTimeCommands();
+    }
+
+    // Submitting every upload recorded since beginUploadBatch at once, then releasing their staging buffers
+    void submitUploadBatch() {
+        endSingleTimeCommands(uploadBatchCommandBuffer);
+        uploadBatchCommandBuffer = VK_NULL_HANDLE;
+
+        for (auto& stagingBuffer : uploadBatchStagingBuffers) {
+            vkDestroyBuffer(logicalDevice, stagingBuffer.first, nullptr);
+            memoryAllocator.free(stagingBuffer.second);
+        }
+        uploadBatchStagingBuffers.clear();
+    }
+
+    void copyBuffer(VkCommandBuffer commandBuffer, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
+        VkBufferCopy copyRegion = {};
+        //copyRegion.srcOffset = 0;
+        //copyRegion.dstOffset = 0;
+        copyRegion.size = size;
+        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+    }
+
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            if ((typeFilter &(1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return i;
+            }
+        }
+
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    void createCommandBuffers() {
+        commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+        VkCommandBufferAllocateInfo cbAllocateInfo = {};
+        cbAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cbAllocateInfo.commandPool = commandPool;
+        cbAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; // this command buffer can be submitted but not be called from other command buffers
+                                                                // secondary level command buffers CANNOT be submitted but can be called from other command buffers
+        cbAllocateInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+
+        std::cout << "...creating a command buffer..." << std::endl;
+        VkResult res = vkAllocateCommandBuffers(logicalDevice, &cbAllocateInfo, commandBuffers.data());
+        if (res != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+    }
+
+    // Recording the draw of the current frame in flight (its descriptor set) into the given swap chain image
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imgIndex) {
+        vkResetCommandBuffer(commandBuffer, 0);
+
+        VkCommandBufferBeginInfo cbBeginInfo = {};
+        cbBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        cbBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // re-recorded every frame once its fence has signalled
+        //cbBeginInfo.pInheritanceInfo = nullptr; // only relevant for secondary command buffers 
+        
+        VkResult beginRes = vkBeginCommandBuffer(commandBuffer, &cbBeginInfo);
+        if (beginRes != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+
+        // the whole image is cleared and drawn once, then only its damaged tiles are redrawn on top of the previous contents
+        bool fullRedraw = !options.damageTracking || outputTileDamageCount[imgIndex] == outputTilesX * outputTilesY;
+        if (!fullRedraw) {
+            collectDamageScissors(imgIndex);
+        }
+        if (capture) {
+            captureStats.drawnOutputTiles += outputTileDamageCount[imgIndex];
+            captureStats.outputTiles += outputTilesX * outputTilesY;
+        }
+        clearOutputDamage(imgIndex);
+
+        VkRenderPassBeginInfo renderPassBeginInfo = {};
+        renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassBeginInfo.renderPass = fullRedraw ? renderPass : renderPassLoad;
+        renderPassBeginInfo.framebuffer = swapChainFramebuffers[imgIndex];
+        renderPassBeginInfo.renderArea.offset = {0, 0};
+        renderPassBeginInfo.renderArea.extent = swapChainExtent;
+        VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
+        renderPassBeginInfo.clearValueCount = 1;
+        renderPassBeginInfo.pClearValues = &clearColor; // clear values to be used for clearing framebuffer before new render pass (with colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR)
+        
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+            VkBuffer vertexBuffers[] = {vertexBuffer};
+            VkDeviceSize offsets[] = {0};
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+            vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, drawIndexType);
+
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
+
+            VkViewport viewport = {};
+            viewport.x = 0.0f;
+            viewport.y = 0.0f;
+            viewport.width  = (float) swapChainExtent.width;
+            viewport.height = (float) swapChainExtent.height;
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
+            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+            if (fullRedraw) {
+                VkRect2D scissor = {{0, 0}, swapChainExtent};
+                vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+                vkCmdDrawIndexed(commandBuffer, drawIndexCount, 1, 0, 0, 0);
+            } else {
+                for (const VkRect2D& scissor : damageScissors) {
+                    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+                    vkCmdDrawIndexed(commandBuffer, drawIndexCount, 1, 0, 0, 0);
+                }
+            }
+        vkCmdEndRenderPass(commandBuffer);
+
+        if (options.headless) {
+            recordReadback(commandBuffer, imgIndex);
+        }
+
+        VkResult endRes = vkEndCommandBuffer(commandBuffer);
+        if (endRes != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+    }
+
+    // Copying the offscreen target into its readback buffer, visible to the host once the frame's fence has signalled
+    // (the render pass leaves the target in TRANSFER_SRC_OPTIMAL, its outgoing dependency covers the copy)
+    void recordReadback(VkCommandBuffer commandBuffer, uint32_t imgIndex) {
+        VkBufferImageCopy region = {};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0; // tightly packed
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {swapChainExtent.width, swapChainExtent.height, 1};
+        VkBuffer readbackBuffer = batchSlot ? batchSlot->output : readbackBuffers[imgIndex];
+        vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imgIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = readbackBuffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    void createUploadCommandBuffers() {
+        uploadCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+        VkCommandBufferAllocateInfo cbAllocateInfo = {};
+        cbAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cbAllocateInfo.commandPool = commandPool;
+        cbAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cbAllocateInfo.commandBufferCount = (uint32_t) uploadCommandBuffers.size();
+
+        std::cout << "...creating upload command buffers..." << std::endl;
+        VkResult res = vkAllocateCommandBuffers(logicalDevice, &cbAllocateInfo, uploadCommandBuffers.data());
+        if (res != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate upload command buffers!");
+        }
+
+        if (transferQueueDedicated) {
+            transferCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+            cbAllocateInfo.commandPool = transferCommandPool;
+
+            res = vkAllocateCommandBuffers(logicalDevice, &cbAllocateInfo, transferCommandBuffers.data());
+            if (res != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate transfer command buffers!");
+            }
+        }
+    }
+
+    void createSyncObjs() {
+        imgAvailSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+
+        VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        VkFenceCreateInfo fenceCreateInfo = {};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        
+        std::cout << "...creating semaphores and fences..." << std::endl;
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            VkResult semRes1 = vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &imgAvailSemaphores[i]);
+            VkResult semRes2 = vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &renderFinishedSemaphores[i]);
+            VkResult fenceRes = vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &inFlightFences[i]);
+            if (semRes1 != VK_SUCCESS || semRes2 != VK_SUCCESS || fenceRes != VK_SUCCESS) {
+                throw std::runtime_error("failed to create sync objects for a frame!");
+            }
+        }
+
+        if (transferQueueDedicated) {
+            uploadCompleteSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+            for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                if (vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &uploadCompleteSemaphores[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create upload semaphore for a frame!");
+                }
+            }
+        }
+
+        if (options.watchWarpMap) {
+            fenceCreateInfo.flags = 0;
+            if (vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &warpReloadSemaphore) != VK_SUCCESS
+                || vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &warpReloadFence) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create warp map reload sync objects!");
+            }
+        }
+    }
+
+    void updateUniformBuffer(size_t frameIndex) {
+        //static auto startTime = std::chrono::high_resolution_clock::now();
+
+        //auto currentTime = std::chrono::high_resolution_clock::now();
+        //float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+        time_t currentTime;
+        time(&currentTime);
+
+        frameNumber++;
+
+        if (difftime(currentTime, globalStartTime) >= 1.0f) {
+            std::cout << float(frameNumber) / 1.0f << " fps" << std::endl;
+            if (capture) {
+                reportCaptureStats();
+            }
+            globalStartTime = currentTime;
+            //std::cout << frameNumber << std::endl;
+            frameNumber = 0;
+        }
+        //std::cout << difftime(currentTime, globalStartTime) << std::endl;
+
+        // necessary for pipeline but not used
+        UniformBufferObject ubo = {};
+        ubo.model = glm::mat4(1.0f);
+        ubo.view = glm::mat4(1.0f);
+        ubo.proj = glm::mat4(1.0f);
+
+        memcpy(uniformBuffersMemory[frameIndex].mapped, &ubo, sizeof(ubo));
+    }
+
+    #if __linux__
+    static bool shmAttachFailed;
+
+    static int shmAttachErrorHandler(Display* display, XErrorEvent* error) {
+        shmAttachFailed = true;
+        return 0;
+    }
+
+    // Creating the capture slots as shared-memory XImages (falls back to XGetImage when MIT-SHM is unavailable, e.g. remote displays)
+    void initScreenCapture() {
+        captureSlots.resize(CAPTURE_POOL_SIZE);
+
+        if (!XShmQueryExtension(display)) {
+            std::cout << "MIT-SHM not available, falling back to XGetImage capture" << std::endl;
+            return;
+        }
+
+        Visual* visual = DefaultVisual(display, DefaultScreen(display));
+        int depth = DefaultDepth(display, DefaultScreen(display));
+
+        for (auto& slot : captureSlots) {
+            slot.image = XShmCreateImage(display, visual, depth, ZPixmap, nullptr, &slot.shmInfo, HEIGHT, HEIGHT);
+            if (slot.image == nullptr) {
+                break;
+            }
+            size_t imageSize = slot.image->bytes_per_line * slot.image->height;
+            slot.shmSize = (imageSize + CAPTURE_SHM_ALIGNMENT - 1) / CAPTURE_SHM_ALIGNMENT * CAPTURE_SHM_ALIGNMENT;
+            slot.shmInfo.shmid = shmget(IPC_PRIVATE, slot.shmSize, IPC_CREAT | 0600);
+            if (slot.shmInfo.shmid < 0) {
+                break;
+            }
+            slot.shmInfo.shmaddr = slot.image->data = (char*) shmat(slot.shmInfo.shmid, nullptr, 0);
+            slot.shmInfo.readOnly = False;
+            if (slot.shmInfo.shmaddr == (char*) -1) {
+                shmctl(slot.shmInfo.shmid, IPC_RMID, nullptr);
+                slot.shmInfo.shmaddr = slot.image->data = nullptr;
+                slot.shmInfo.shmid = -1;
+                break;
+            }
+
+            shmAttachFailed = false;
+            XErrorHandler previousHandler = XSetErrorHandler(shmAttachErrorHandler);
+            XShmAttach(display, &slot.shmInfo);
+            XSync(display, False);
+            XSetErrorHandler(previousHandler);
+            shmctl(slot.shmInfo.shmid, IPC_RMID, nullptr); // segment is released as soon as both sides detach
+            if (shmAttachFailed) {
+                slot.shmInfo.shmid = -1;
+                break;
+            }
+        }
+
+        shmCapture = std::all_of(captureSlots.begin(), captureSlots.end(),
+                                 [](const CaptureSlot& slot) { return slot.image != nullptr && slot.shmInfo.shmid >= 0; });
+        if (!shmCapture) {
+            std::cout << "failed to set up MIT-SHM capture, falling back to XGetImage capture" << std::endl;
+            cleanupScreenCapture();
+            captureSlots.resize(CAPTURE_POOL_SIZE);
+            return;
+        }
+        std::cout << "MIT-SHM Screen Capture Pool Created" << std::endl;
+    }
+
+    void cleanupScreenCapture() {
+        for (auto& slot : captureSlots) {
+            if (slot.shmInfo.shmid >= 0 && slot.shmInfo.shmaddr != nullptr) {
+                XShmDetach(display, &slot.shmInfo);
+            }
+            if (slot.image != nullptr) {
+                XDestroyImage(slot.image); // frees XGetImage pixels, but not shared memory data
+            }
+            if (slot.shmInfo.shmaddr != nullptr) {
+                shmdt(slot.shmInfo.shmaddr);
+            }
+        }
+        captureSlots.clear();
+        screenCapture = nullptr;
+        shmCapture = false;
+    }
+
+    // Grabbing the capture region into the given slot (no allocations in steady state with MIT-SHM)
+    XImage* grabScreen(uint32_t slotIndex) {
+        CaptureSlot& slot = captureSlots[slotIndex];
+        if (shmCapture) {
+            if (!XShmGetImage(display, root_window, slot.image, CAPTURE_OFFSET_X, CAPTURE_OFFSET_Y, AllPlanes)) {
+                throw std::runtime_error("failed to capture screen through MIT-SHM!");
+            }
+            return slot.image;
+        }
+
+        if (slot.image != nullptr) {
+            XDestroyImage(slot.image); // frees both the XImage struct and its pixels
+        }
+        slot.image = XGetImage(display, root_window, CAPTURE_OFFSET_X, CAPTURE_OFFSET_Y, HEIGHT, HEIGHT, AllPlanes, ZPixmap);
+        if (slot.image == nullptr) {
+            throw std::runtime_error("failed to capture screen!");
+        }
+        return slot.image;
+    }
+
+    void hashCaptureTiles(CaptureSlot& slot) {
+        const XImage* image = slot.image;
+        uint32_t tilesX = (image->width + CAPTURE_TILE_SIZE - 1) / CAPTURE_TILE_SIZE;
+        uint32_t tilesY = (image->height + CAPTURE_TILE_SIZE - 1) / CAPTURE_TILE_SIZE;
+        slot.tileHashes.resize(tilesX * tilesY);
+
+        for (uint32_t ty = 0; ty < tilesY; ty++) {
+            uint32_t rows = std::min(CAPTURE_TILE_SIZE, image->height - static_cast<int>(ty * CAPTURE_TILE_SIZE));
+            for (uint32_t tx = 0; tx < tilesX; tx++) {
+                uint32_t columns = std::min(CAPTURE_TILE_SIZE, image->width - static_cast<int>(tx * CAPTURE_TILE_SIZE));
+                const uint8_t* tile = reinterpret_cast<const uint8_t*>(image->data)
+                                    + ty * CAPTURE_TILE_SIZE * image->bytes_per_line + tx * CAPTURE_TILE_SIZE * 4;
+                slot.tileHashes[ty * tilesX + tx] = hashTile(tile, image->bytes_per_line, columns * 4, rows);
+            }
+        }
+    }
+    #endif
+
+    // Capturing on a dedicated thread, so that a slow X server never stalls presentation
+    void captureLoop() {
+        #if __linux__
+            const auto capturePeriod = std::chrono::microseconds(1000000 / CAPTURE_MAX_FPS);
+            auto nextCapture = std::chrono::steady_clock::now();
+
+            while (captureRunning.load(std::memory_order_relaxed)) {
+                auto captureStart = std::chrono::steady_clock::now();
+                try {
+                    grabScreen(captureFrames.backSlot());
+                } catch (const std::exception& e) {
+                    std::cerr << e.what() << std::endl;
+                    std::this_thread::sleep_for(capturePeriod);
+                    continue;
+                }
+                auto captureEnd = std::chrono::steady_clock::now();
+                captureStats.captureMicros += std::chrono::duration_cast<std::chrono::microseconds>(captureEnd - captureStart).count();
+
+                hashCaptureTiles(captureSlots[captureFrames.backSlot()]);
+                captureStats.hashMicros += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - captureEnd).count();
+
+                if (captureFrames.publish()) {
+                    captureStats.dropped++;
+                }
+                captureStats.captured++;
+
+                nextCapture += capturePeriod;
+                if (nextCapture < captureEnd) {
+                    nextCapture = captureEnd; // capture is slower than the cap, do not try to catch up
+                }
+                std::this_thread::sleep_until(nextCapture);
+            }
+        #endif
+    }
+
+    void startCaptureThread() {
+        captureRunning = true;
+        captureThread = std::thread(&VkWarpApp::captureLoop, this);
+        std::cout << "Capture Thread Started" << std::endl;
+    }
+
+    void stopCaptureThread() {
+        if (captureThread.joinable()) {
+            captureRunning = false;
+            captureThread.join();
+            std::cout << "Capture Thread Stopped" << std::endl;
+        }
+    }
+
+    void reportCaptureStats() {
+        uint64_t captured = captureStats.captured.exchange(0);
+        uint64_t dropped = captureStats.dropped.exchange(0);
+        uint64_t captureMicros = captureStats.captureMicros.exchange(0);
+
+        uint64_t hashMicros = captureStats.hashMicros.exchange(0);
 
-        VkMemoryAllocateInfo memoryAllocateInfo = {};
-        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        memoryAllocateInfo.allocationSize = memoryRequirements.size;
-        memoryAllocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits,
-                                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        
-        if (vkAllocateMemory(logicalDevice, &memoryAllocateInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("faild to allocate vertex buffer memory");
+        std::cout << "capture: " << captured << " fps, " << captureStats.consumed << " uploaded, " << dropped << " dropped, "
+                  << captureStats.duplicated << " duplicated, " << captureStats.unchanged << " unchanged";
+        if (captured > 0) {
+            std::cout << ", " << captureMicros / 1000.0 / captured << " ms/capture, " << hashMicros / 1000.0 / captured << " ms/hash";
+        }
+        if (captureStats.checkedTiles > 0) {
+            std::cout << ", " << 100.0 * captureStats.dirtyTiles / captureStats.checkedTiles << "% dirty tiles";
         }
-        vkBindBufferMemory(logicalDevice, buffer, bufferMemory, 0);
+        if (captureStats.outputTiles > 0) {
+            std::cout << ", " << 100.0 * captureStats.drawnOutputTiles / captureStats.outputTiles << "% output tiles drawn";
+        }
+        std::cout << std::endl;
+
+        captureStats.consumed = 0;
+        captureStats.duplicated = 0;
+        captureStats.unchanged = 0;
+        captureStats.dirtyTiles = 0;
+        captureStats.checkedTiles = 0;
+        captureStats.drawnOutputTiles = 0;
+        captureStats.outputTiles = 0;
     }
 
-    VkCommandBuffer beginSingleTimeCommands() {
-        VkCommandBufferAllocateInfo bufferAllocateInfo = {};
-        bufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        bufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        bufferAllocateInfo.commandPool = commandPool;
-        bufferAllocateInfo.commandBufferCount = 1;
+    // Importing every shared-memory capture slot as a transfer source buffer, so that captures skip the staging copy
+    void importCaptureMemory() {
+        #if __linux__
+            if (!hostMemoryImport || !shmCapture) {
+                hostMemoryImport = false;
+                return;
+            }
 
-        VkCommandBuffer commandBuffer;
-        vkAllocateCommandBuffers(logicalDevice, &bufferAllocateInfo, &commandBuffer);
+            auto getHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT) vkGetDeviceProcAddr(logicalDevice, "vkGetMemoryHostPointerPropertiesEXT");
+            if (getHostPointerProperties == nullptr) {
+                hostMemoryImport = false;
+                return;
+            }
 
-        VkCommandBufferBeginInfo commandBufferBeginInfo = {};
-        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            // shmat only guarantees page alignment, which may be finer than what the device imports
+            for (const CaptureSlot& slot : captureSlots) {
+                if (reinterpret_cast<uintptr_t>(slot.shmInfo.shmaddr) % hostPointerAlignment != 0 || slot.shmSize % hostPointerAlignment != 0) {
+                    std::cout << "capture shared memory not aligned to " << hostPointerAlignment
+                              << " bytes, captures are copied into the staging buffer" << std::endl;
+                    hostMemoryImport = false;
+                    return;
+                }
+            }
 
-        vkBeginCommandBuffer(commandBuffer ,&commandBufferBeginInfo);
+            captureImportBuffers.resize(captureSlots.size(), VK_NULL_HANDLE);
+            captureImportBuffersMemory.resize(captureSlots.size(), VK_NULL_HANDLE);
 
-        return commandBuffer;
-    }
+            for (size_t i = 0; i < captureSlots.size(); i++) {
+                VkMemoryHostPointerPropertiesEXT hostPointerProperties = {};
+                hostPointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+                VkResult res = getHostPointerProperties(logicalDevice, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+                                                        captureSlots[i].shmInfo.shmaddr, &hostPointerProperties);
+                if (res != VK_SUCCESS) {
+                    throw std::runtime_error("failed to query capture host pointer properties!");
+                }
 
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-        vkEndCommandBuffer(commandBuffer);
+                VkExternalMemoryBufferCreateInfo externalBufferCreateInfo = {};
+                externalBufferCreateInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+                externalBufferCreateInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
 
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+                VkBufferCreateInfo bufferCreateInfo = {};
+                bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+                bufferCreateInfo.pNext = &externalBufferCreateInfo;
+                bufferCreateInfo.size = captureSlots[i].shmSize;
+                bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+                bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(graphicsQueue); // this could be substituted with a fence (more advanced and flexible)
+                res = vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &captureImportBuffers[i]);
+                if (res != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create capture import buffer!");
+                }
 
-        vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
-    }
+                VkMemoryRequirements memoryRequirements;
+                vkGetBufferMemoryRequirements(logicalDevice, captureImportBuffers[i], &memoryRequirements);
 
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-        
-        VkBufferCopy copyRegion = {};
-        //copyRegion.srcOffset = 0;
-        //copyRegion.dstOffset = 0;
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-        
-        endSingleTimeCommands(commandBuffer);
-    }
+                VkImportMemoryHostPointerInfoEXT importInfo = {};
+                importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+                importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+                importInfo.pHostPointer = captureSlots[i].shmInfo.shmaddr;
 
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memoryProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+                VkMemoryAllocateInfo memoryAllocateInfo = {};
+                memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+                memoryAllocateInfo.pNext = &importInfo;
+                memoryAllocateInfo.allocationSize = captureSlots[i].shmSize;
+                memoryAllocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits & hostPointerProperties.memoryTypeBits, 0);
 
-        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
-            if ((typeFilter &(1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
+                res = vkAllocateMemory(logicalDevice, &memoryAllocateInfo, nullptr, &captureImportBuffersMemory[i]);
+                if (res != VK_SUCCESS) {
+                    throw std::runtime_error("failed to import capture memory!");
+                }
+                vkBindBufferMemory(logicalDevice, captureImportBuffers[i], captureImportBuffersMemory[i], 0);
             }
-        }
+            std::cout << "Capture Memory Imported" << std::endl;
+        #endif
     }
 
-    void createCommandBuffers() {
-        commandBuffers.resize(swapChainFramebuffers.size());
+    // Recording the upload of the newest capture into commandBuffer, returns false if there was nothing new to upload.
+    // Only the tiles whose hash differs from the ones held by this frame's color texture are copied.
+    bool updateScreenCapture(VkCommandBuffer commandBuffer) {
+        // pick up the newest complete capture, if any (otherwise the previous one is shown again)
+        if (captureFrames.acquire()) {
+            latestCaptureSerial++;
+            captureStats.consumed++;
+        } else {
+            captureStats.duplicated++;
+        }
+        // this frame's color texture may still hold an older capture than the one shown by the previous frame
+        if (colorTextureSerials[currentFrame] == latestCaptureSerial) {
+            return false;
+        }
+        colorTextureSerials[currentFrame] = latestCaptureSerial;
+        VkImage colorTextureImage = colorTextureImages[currentFrame];
 
-        VkCommandBufferAllocateInfo cbAllocateInfo = {};
-        cbAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        cbAllocateInfo.commandPool = commandPool;
-        cbAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; // this command buffer can be submitted but not be called from other command buffers
-                                                                // secondary level command buffers CANNOT be submitted but can be called from other command buffers
-        cbAllocateInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+        #if __linux__
+            const CaptureSlot& slot = captureSlots[captureFrames.frontSlot()];
+            screenCapture = slot.image;
+            const uint8_t* colorPixels = reinterpret_cast<const uint8_t*>(screenCapture->data);
+            uint32_t tilesX = (screenCapture->width + CAPTURE_TILE_SIZE - 1) / CAPTURE_TILE_SIZE;
+            std::vector<uint32_t>& textureTileHashes = colorTextureTileHashes[currentFrame];
+
+            // imported capture memory is read by the copy directly, otherwise dirty tiles are packed into a slice of this frame's staging ring
+            VkBuffer copySource = hostMemoryImport ? captureImportBuffers[captureFrames.frontSlot()] : VK_NULL_HANDLE;
+            VkDeviceSize stagingOffset = 0;
+
+            dirtyTileRegions.clear();
+            for (size_t tile = 0; tile < slot.tileHashes.size(); tile++) {
+                if (textureTileHashes[tile] == slot.tileHashes[tile]) {
+                    continue;
+                }
+                textureTileHashes[tile] = slot.tileHashes[tile];
+
+                int32_t x = static_cast<int32_t>(tile % tilesX) * CAPTURE_TILE_SIZE;
+                int32_t y = static_cast<int32_t>(tile / tilesX) * CAPTURE_TILE_SIZE;
+                uint32_t width = std::min(CAPTURE_TILE_SIZE, screenCapture->width - x);
+                uint32_t height = std::min(CAPTURE_TILE_SIZE, screenCapture->height - y);
+                const uint8_t* tilePixels = colorPixels + y * screenCapture->bytes_per_line + x * 4;
+
+                VkBufferImageCopy region = {};
+                region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                region.imageSubresource.mipLevel = 0;
+                region.imageSubresource.baseArrayLayer = 0;
+                region.imageSubresource.layerCount = 1;
+                region.imageOffset = {x, y, 0};
+                region.imageExtent = {width, height, 1};
+                if (hostMemoryImport) {
+                    region.bufferOffset = tilePixels - colorPixels;
+                    region.bufferRowLength = screenCapture->bytes_per_line / 4;
+                } else {
+                    region.bufferOffset = stagingOffset; // relative to the staging slice until its size is known
+                    region.bufferRowLength = 0; // tightly packed
+                    stagingOffset += width * height * 4;
+                }
+                dirtyTileRegions.push_back(region);
+            }
 
-        std::cout << "...creating a command buffer..." << std::endl;
-        VkResult res = vkAllocateCommandBuffers(logicalDevice, &cbAllocateInfo, commandBuffers.data());
-        if (res != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate command buffers!");
-        }
+            if (!hostMemoryImport && !dirtyTileRegions.empty()) {
+                StagingSlice staging = allocateStaging(currentFrame, stagingOffset);
+                copySource = staging.buffer;
+                for (auto& region : dirtyTileRegions) {
+                    const uint8_t* tilePixels = colorPixels + region.imageOffset.y * screenCapture->bytes_per_line + region.imageOffset.x * 4;
+                    for (uint32_t row = 0; row < region.imageExtent.height; row++) {
+                        memcpy(staging.data + region.bufferOffset + row * region.imageExtent.width * 4,
+                               tilePixels + row * screenCapture->bytes_per_line, region.imageExtent.width * 4);
+                    }
+                    region.bufferOffset += staging.offset;
+                }
+            }
 
-        for (size_t i = 0; i < commandBuffers.size(); i++) {
-            VkCommandBufferBeginInfo cbBeginInfo = {};
-            cbBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            cbBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT; // command buffer can be resubmitted while it is already waiting for execution (other options: discarded right after execution, secondary command buffer within single render pass)
-            //cbBeginInfo.pInheritanceInfo = nullptr; // only relevant for secondary command buffers 
-            
-            std::cout << "...beginning command buffer recording..." << std::endl;
-            VkResult beginRes = vkBeginCommandBuffer(commandBuffers[i], &cbBeginInfo);
-            if (beginRes != VK_SUCCESS) {
-                throw std::runtime_error("failed to begin recording command buffer!");
-            }
-
-            VkRenderPassBeginInfo renderPassBeginInfo = {};
-            renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassBeginInfo.renderPass = renderPass;
-            renderPassBeginInfo.framebuffer = swapChainFramebuffers[i];
-            renderPassBeginInfo.renderArea.offset = {0, 0};
-            renderPassBeginInfo.renderArea.extent = swapChainExtent;
-            VkClearValue clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
-            renderPassBeginInfo.clearValueCount = 1;
-            renderPassBeginInfo.pClearValues = &clearColor; // clear values to be used for clearing framebuffer before new render pass (with colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR)
-            
-            vkCmdBeginRenderPass(commandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-                vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+            captureStats.checkedTiles += slot.tileHashes.size();
+            captureStats.dirtyTiles += dirtyTileRegions.size();
+            if (dirtyTileRegions.empty()) {
+                captureStats.unchanged++;
+                return false;
+            }
+            if (hostMemoryImport) {
+                captureFrames.hold(currentFrame); // not handed back to the capture thread before this frame's fence
+            }
+
+            // update VkImage and, thus, its VkImageView (the other tiles keep their contents)
+            if (transferQueueDedicated) {
+                // the previous frames sampling this texture have completed (in-flight fence), the semaphore makes the copy visible to them
+                recordImageBarrier(commandBuffer, colorTextureImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+                    vkCmdCopyBufferToImage(commandBuffer, copySource, colorTextureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                           static_cast<uint32_t>(dirtyTileRegions.size()), dirtyTileRegions.data());
+                recordImageBarrier(commandBuffer, colorTextureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                   VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+            } else {
+                transitionImageLayout(commandBuffer, colorTextureImage, colorTexFormat, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+                    vkCmdCopyBufferToImage(commandBuffer, copySource, colorTextureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                           static_cast<uint32_t>(dirtyTileRegions.size()), dirtyTileRegions.data());
+                transitionImageLayout(commandBuffer, colorTextureImage, colorTexFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            }
+            return true;
+        #else
+            return false;
+        #endif
+    }
 
-                VkBuffer vertexBuffers[] = {vertexBuffer};
-                VkDeviceSize offsets[] = {0};
-                vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-                vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+    void recordImageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+                            VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage,
+                            uint32_t mipLevels = 1) {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
 
-                vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+        vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
 
-                vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-            vkCmdEndRenderPass(commandBuffers[i]);
+    void beginFrameCommandBuffer(VkCommandBuffer commandBuffer) {
+        vkResetCommandBuffer(commandBuffer, 0);
 
-            std::cout << "...ending command buffer recording..." << std::endl;
-            VkResult endRes = vkEndCommandBuffer(commandBuffers[i]);
-            if (endRes != VK_SUCCESS) {
-                throw std::runtime_error("failed to record command buffer!");
-            }
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording upload command buffer!");
         }
     }
 
-    void createSyncObjs() {
-        imgAvailSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    void endFrameCommandBuffer(VkCommandBuffer commandBuffer) {
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record upload command buffer!");
+        }
+    }
 
-        VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    // Re-recording this frame's upload command buffer, returns false if it has nothing to submit.
+    // With a dedicated transfer queue the copy is submitted there right away (signalling uploadCompleteSemaphores,
+    // waitForTransfer is set) and the graphics queue has nothing to record.
+    bool recordFrameUploads(VkCommandBuffer commandBuffer, bool& waitForTransfer) {
+        waitForTransfer = false;
+        if (batchSlot) {
+            // the whole batch frame replaces the color texture of this frame in flight (no capture, so no transfer queue)
+            beginFrameCommandBuffer(commandBuffer);
+            transitionImageLayout(commandBuffer, colorTextureImages[currentFrame], colorTexFormat, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+                copyBufferToImage(commandBuffer, batchSlot->input, colorTextureImages[currentFrame], colorTextureWidth, colorTextureHeight);
+            transitionImageLayout(commandBuffer, colorTextureImages[currentFrame], colorTexFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            endFrameCommandBuffer(commandBuffer);
+            return true;
+        }
+        if (!capture) {
+            return false;
+        }
 
-        VkFenceCreateInfo fenceCreateInfo = {};
-        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-        
-        std::cout << "...creating semaphores and fences..." << std::endl;
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            VkResult semRes1 = vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &imgAvailSemaphores[i]);
-            VkResult semRes2 = vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &renderFinishedSemaphores[i]);
-            VkResult fenceRes = vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &inFlightFences[i]);
-            if (semRes1 != VK_SUCCESS || semRes2 != VK_SUCCESS || fenceRes != VK_SUCCESS) {
-                throw std::runtime_error("failed to create sync objects for a frame!");
-            }
+        if (!transferQueueDedicated) {
+            beginFrameCommandBuffer(commandBuffer);
+            bool uploadRecorded = updateScreenCapture(commandBuffer);
+            endFrameCommandBuffer(commandBuffer);
+            return uploadRecorded;
         }
-    }
 
-    void updateUniformBuffer(uint32_t currentImage) {
-        //static auto startTime = std::chrono::high_resolution_clock::now();
+        // the previous submission of this transfer command buffer was waited on by the frame's in-flight fence
+        VkCommandBuffer transferCommandBuffer = transferCommandBuffers[currentFrame];
+        beginFrameCommandBuffer(transferCommandBuffer);
+        bool uploadRecorded = updateScreenCapture(transferCommandBuffer);
+        endFrameCommandBuffer(transferCommandBuffer);
+        if (!uploadRecorded) {
+            return false;
+        }
 
-        //auto currentTime = std::chrono::high_resolution_clock::now();
-        //float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
-        time_t currentTime;
-        time(&currentTime);
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &transferCommandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &uploadCompleteSemaphores[currentFrame];
+        if (vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit transfer command buffer!");
+        }
 
-        frameNumber++;
+        waitForTransfer = true;
+        return false;
+    }
 
-        if (difftime(currentTime, globalStartTime) >= 1.0f) {
-            std::cout << float(frameNumber) / 1.0f << " fps" << std::endl;
-            globalStartTime = currentTime;
-            //std::cout << frameNumber << std::endl;
-            frameNumber = 0;
+    // For every capture tile, the output tiles whose pixels may sample it through the warp map.
+    // Conservative: each bilinear cell of the warp map may sample anything inside the bounding box of its four uv values,
+    // widened by one color texel for the bilinear filtering of the color texture (REPEAT addressing wraps at the borders).
+    // Corners with zero intensity are skipped only when the intensity is applied, and the 8-bit mode widens the box by
+    // the 1/255 its uv truncation may move the sampled position by (up to ~4 texels of a 1080p color texture).
+    void buildTileDependencyIndex() {
+        outputTilesX = (swapChainExtent.width + OUTPUT_TILE_SIZE - 1) / OUTPUT_TILE_SIZE;
+        outputTilesY = (swapChainExtent.height + OUTPUT_TILE_SIZE - 1) / OUTPUT_TILE_SIZE;
+        // new swap chain images: everything has to be drawn once
+        outputTileDamage.assign(swapChainImages.size(), std::vector<uint8_t>(outputTilesX * outputTilesY, 1));
+        outputTileDamageCount.assign(swapChainImages.size(), outputTilesX * outputTilesY);
+
+        sourceTileOutputs.clear();
+        if (!capture || !options.damageTracking || warpMap.empty()) {
+            return;
         }
-        //std::cout << difftime(currentTime, globalStartTime) << std::endl;
 
-        // necessary for pipeline but not used
-        UniformBufferObject ubo = {};
-        ubo.model = glm::mat4(1.0f);
-        ubo.view = glm::mat4(1.0f);
-        ubo.proj = glm::mat4(1.0f);
+        int64_t sourceTilesX = (colorTextureWidth + CAPTURE_TILE_SIZE - 1) / CAPTURE_TILE_SIZE;
+        int64_t sourceTilesY = (colorTextureHeight + CAPTURE_TILE_SIZE - 1) / CAPTURE_TILE_SIZE;
+        sourceTileOutputs.resize(sourceTilesX * sourceTilesY);
+        std::vector<uint32_t> lastOutputTile(sourceTileOutputs.size(), std::numeric_limits<uint32_t>::max());
+
+        glm::vec2 quadMin = (*quadVertices)[0].pos; // texCoord (0, 0)
+        glm::vec2 quadMax = (*quadVertices)[2].pos; // texCoord (1, 1)
+        auto warpTexel = [&](int64_t i, int64_t j) {
+            // clamped like the warp sampler (CLAMP_TO_EDGE)
+            i = std::min<int64_t>(std::max<int64_t>(i, 0), warpMapWidth - 1);
+            j = std::min<int64_t>(std::max<int64_t>(j, 0), warpMapHeight - 1);
+            return &warpMap[3 * (j * warpMapWidth + i)];
+        };
+        // color texel range -> capture tile range, with the texels past the borders wrapping around
+        auto tileRange = [](int64_t first, int64_t last, int64_t size, int64_t tiles, std::vector<int64_t>& range) {
+            range.clear();
+            for (int64_t t = std::max<int64_t>(first, 0) / CAPTURE_TILE_SIZE; t <= std::min(last, size - 1) / CAPTURE_TILE_SIZE; t++) {
+                range.push_back(t);
+            }
+            if (first < 0) {
+                range.push_back(tiles - 1);
+            }
+            if (last >= size) {
+                range.push_back(0);
+            }
+        };
+        std::vector<int64_t> sourceColumns, sourceRows;
+        float uvSlack = options.warpMode == WARP_MODE_8BIT ? 1.0f / 255.0f : 0.0f;
+
+        for (uint32_t ty = 0; ty < outputTilesY; ty++) {
+            for (uint32_t tx = 0; tx < outputTilesX; tx++) {
+                uint32_t outputTile = ty * outputTilesX + tx;
+
+                // texture coordinates of the first and last pixel centres of the tile
+                float px0 = tx * OUTPUT_TILE_SIZE + 0.5f;
+                float px1 = std::min<uint32_t>((tx + 1) * OUTPUT_TILE_SIZE, swapChainExtent.width) - 0.5f;
+                float py0 = ty * OUTPUT_TILE_SIZE + 0.5f;
+                float py1 = std::min<uint32_t>((ty + 1) * OUTPUT_TILE_SIZE, swapChainExtent.height) - 0.5f;
+                float s0 = (2.0f * px0 / swapChainExtent.width - 1.0f - quadMin.x) / (quadMax.x - quadMin.x);
+                float s1 = (2.0f * px1 / swapChainExtent.width - 1.0f - quadMin.x) / (quadMax.x - quadMin.x);
+                float t0 = (2.0f * py0 / swapChainExtent.height - 1.0f - quadMin.y) / (quadMax.y - quadMin.y);
+                float t1 = (2.0f * py1 / swapChainExtent.height - 1.0f - quadMin.y) / (quadMax.y - quadMin.y);
+                if (s1 < 0.0f || s0 > 1.0f || t1 < 0.0f || t0 > 1.0f) {
+                    continue; // outside the quad, never drawn
+                }
+
+                // cell (i, j) interpolates warp texels i..i+1, j..j+1
+                int64_t i0 = (int64_t) std::floor(std::max(s0, 0.0f) * warpMapWidth - 0.5f);
+                int64_t i1 = (int64_t) std::floor(std::min(s1, 1.0f) * warpMapWidth - 0.5f);
+                int64_t j0 = (int64_t) std::floor(std::max(t0, 0.0f) * warpMapHeight - 0.5f);
+                int64_t j1 = (int64_t) std::floor(std::min(t1, 1.0f) * warpMapHeight - 0.5f);
+                for (int64_t j = j0; j <= j1; j++) {
+                    for (int64_t i = i0; i <= i1; i++) {
+                        float uMin = 1.0f, uMax = 0.0f, vMin = 1.0f, vMax = 0.0f;
+                        bool visible = false;
+                        for (int corner = 0; corner < 4; corner++) {
+                            const uint16_t* texel = warpTexel(i + (corner & 1), j + (corner >> 1));
+                            if (texel[2] == 0 && options.applyIntensity) {
+                                continue; // zero intensity, whatever is sampled ends up black
+                            }
+                            visible = true;
+                            uMin = std::min(uMin, texel[0] / 65535.0f);
+                            uMax = std::max(uMax, texel[0] / 65535.0f);
+                            vMin = std::min(vMin, texel[1] / 65535.0f);
+                            vMax = std::max(vMax, texel[1] / 65535.0f);
+                        }
+                        if (!visible) {
+                            continue;
+                        }
+                        uMin -= uvSlack;
+                        uMax += uvSlack;
+                        vMin -= uvSlack;
+                        vMax += uvSlack;
+
+                        tileRange((int64_t) std::floor(uMin * colorTextureWidth - 0.5f), (int64_t) std::floor(uMax * colorTextureWidth - 0.5f) + 1,
+                                  colorTextureWidth, sourceTilesX, sourceColumns);
+                        tileRange((int64_t) std::floor(vMin * colorTextureHeight - 0.5f), (int64_t) std::floor(vMax * colorTextureHeight - 0.5f) + 1,
+                                  colorTextureHeight, sourceTilesY, sourceRows);
+                        for (int64_t row : sourceRows) {
+                            for (int64_t column : sourceColumns) {
+                                size_t sourceTile = row * sourceTilesX + column;
+                                if (lastOutputTile[sourceTile] != outputTile) {
+                                    lastOutputTile[sourceTile] = outputTile;
+                                    sourceTileOutputs[sourceTile].push_back(outputTile);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
 
-        void* data;
-        vkMapMemory(logicalDevice, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-            memcpy(data, &ubo, sizeof(ubo));
-        vkUnmapMemory(logicalDevice, uniformBuffersMemory[currentImage]);
+    void markOutputTileDamaged(uint32_t outputTile) {
+        for (size_t i = 0; i < outputTileDamage.size(); i++) {
+            if (!outputTileDamage[i][outputTile]) {
+                outputTileDamage[i][outputTile] = 1;
+                outputTileDamageCount[i]++;
+            }
+        }
     }
 
-    void updateScreenCapture() {
-        // initialise structures for image
-        int colorTexWidth, colorTexHeight, colorTexChannels;
-        stbi_uc* colorPixels;
+    void clearOutputDamage(uint32_t imgIndex) {
+        std::fill(outputTileDamage[imgIndex].begin(), outputTileDamage[imgIndex].end(), 0);
+        outputTileDamageCount[imgIndex] = 0;
+    }
+
+    // Marking the output tiles depending on the capture tiles that changed since the last drawn frame
+    void propagateCaptureDamage() {
         #if __linux__
-            // capture screen XGetImage
-            screenCapture = XGetImage(display, root_window, 420, 0, HEIGHT, HEIGHT, AllPlanes, ZPixmap);
-            colorTexWidth = screenCapture->width;
-            colorTexHeight = screenCapture->height;
-            colorTexChannels = 4;
-            colorPixels = (stbi_uc*) screenCapture->data;
-            colorTexFormat = VK_FORMAT_B8G8R8A8_UNORM;
-            VkDeviceSize colorImageSize = colorTexWidth * colorTexHeight * 4;
-
-            // pass to stagingBuffer captured data
-            void* colorData;
-            vkMapMemory(logicalDevice, colorStagingBufferMemory, 0, colorImageSize, 0, &colorData);
-                memcpy(colorData, colorPixels, static_cast<size_t>(colorImageSize));
-            vkUnmapMemory(logicalDevice, colorStagingBufferMemory);
-            stbi_image_free(colorPixels);
-
-            // update VkImage and, thus, its VkImageView
-            transitionImageLayout(colorTextureImage, colorTexFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-                copyBufferToImage(colorStagingBuffer, colorTextureImage, static_cast<uint32_t>(colorTexWidth), static_cast<uint32_t>(colorTexHeight));
-            transitionImageLayout(colorTextureImage, colorTexFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            if (!capture || !options.damageTracking || displayedCaptureSerial == latestCaptureSerial) {
+                return;
+            }
+            displayedCaptureSerial = latestCaptureSerial;
+
+            const std::vector<uint32_t>& tileHashes = captureSlots[captureFrames.frontSlot()].tileHashes;
+            for (size_t tile = 0; tile < tileHashes.size(); tile++) {
+                if (displayedTileHashes[tile] == tileHashes[tile]) {
+                    continue;
+                }
+                displayedTileHashes[tile] = tileHashes[tile];
+                if (sourceTileOutputs.empty()) {
+                    // no dependency index (mismatching warp map layers): any change redraws everything
+                    for (uint32_t outputTile = 0; outputTile < outputTilesX * outputTilesY; outputTile++) {
+                        markOutputTileDamaged(outputTile);
+                    }
+                    continue;
+                }
+                for (uint32_t outputTile : sourceTileOutputs[tile]) {
+                    markOutputTileDamaged(outputTile);
+                }
+            }
         #endif
     }
 
+    // Merging the damaged tiles of each tile row into horizontal runs, one scissored draw per run
+    void collectDamageScissors(uint32_t imgIndex) {
+        const std::vector<uint8_t>& damage = outputTileDamage[imgIndex];
+        damageScissors.clear();
+        for (uint32_t ty = 0; ty < outputTilesY; ty++) {
+            uint32_t tx = 0;
+            while (tx < outputTilesX) {
+                if (!damage[ty * outputTilesX + tx]) {
+                    tx++;
+                    continue;
+                }
+                uint32_t runStart = tx;
+                while (tx < outputTilesX && damage[ty * outputTilesX + tx]) {
+                    tx++;
+                }
+
+                VkRect2D scissor = {};
+                scissor.offset = {static_cast<int32_t>(runStart * OUTPUT_TILE_SIZE), static_cast<int32_t>(ty * OUTPUT_TILE_SIZE)};
+                scissor.extent.width = std::min<uint32_t>(tx * OUTPUT_TILE_SIZE, swapChainExtent.width) - runStart * OUTPUT_TILE_SIZE;
+                scissor.extent.height = std::min<uint32_t>((ty + 1) * OUTPUT_TILE_SIZE, swapChainExtent.height) - ty * OUTPUT_TILE_SIZE;
+                damageScissors.push_back(scissor);
+            }
+        }
+    }
+
     void drawFrame() {
+        // from here on every per-frame resource of currentFrame (command buffers, uniform buffer, color texture, staging buffer) is free
         vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-
-        uint32_t imgIndex;
-        VkResult res = vkAcquireNextImageKHR(logicalDevice, swapChain, std::numeric_limits<uint64_t>::max(),
-                                            imgAvailSemaphores[currentFrame], VK_NULL_HANDLE, &imgIndex);
-        if (res == VK_ERROR_OUT_OF_DATE_KHR) {
-            recreateSwapChain();
-            return;
-        } else if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
-            throw std::runtime_error("failed to acquire swap chain image!");
+        captureFrames.release(currentFrame);
+        stagingRings[currentFrame].head = 0;
+        flushDeletionQueue(false);
+
+        // headless: each frame in flight renders into its own offscreen target, free as soon as the fence has signalled
+        uint32_t imgIndex = static_cast<uint32_t>(currentFrame);
+        VkResult res = VK_SUCCESS;
+        if (!options.headless) {
+            res = vkAcquireNextImageKHR(logicalDevice, swapChain, std::numeric_limits<uint64_t>::max(),
+                                        imgAvailSemaphores[currentFrame], VK_NULL_HANDLE, &imgIndex);
+            if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapChain();
+                return;
+            } else if (res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
+                throw std::runtime_error("failed to acquire swap chain image!");
+            }
         }
 
-        updateUniformBuffer(imgIndex);
-        if (capture) {
-            updateScreenCapture();
+        if (options.watchWarpMap) {
+            updateWarpReload();
+            refreshWarpDescriptor();
         }
+        updateUniformBuffer(currentFrame);
+        // uploads are recorded in their own command buffer but go out in the same submission as the draw
+        bool waitForTransfer;
+        bool uploadRecorded = recordFrameUploads(uploadCommandBuffers[currentFrame], waitForTransfer);
+        propagateCaptureDamage();
+        recordCommandBuffer(commandBuffers[currentFrame], imgIndex);
+        VkCommandBuffer submitCommandBuffers[] = {uploadCommandBuffers[currentFrame], commandBuffers[currentFrame]};
 
         VkSubmitInfo submitInfo = {};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore waitSemaphores[] = {imgAvailSemaphores[currentFrame]};
-        VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-        submitInfo.waitSemaphoreCount = 1;
+        // the warp only samples the color texture in the fragment shader, so vertex work can start before the transfer queue is done
+        VkSemaphore waitSemaphores[3];
+        VkPipelineStageFlags waitStages[3];
+        submitInfo.waitSemaphoreCount = 0;
+        if (!options.headless) {
+            waitSemaphores[submitInfo.waitSemaphoreCount] = imgAvailSemaphores[currentFrame];
+            waitStages[submitInfo.waitSemaphoreCount++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        }
+        if (waitForTransfer) {
+            waitSemaphores[submitInfo.waitSemaphoreCount] = uploadCompleteSemaphores[currentFrame];
+            waitStages[submitInfo.waitSemaphoreCount++] = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        }
+        if (waitForWarpReload) {
+            // first frame sampling a reloaded warp map
+            waitSemaphores[submitInfo.waitSemaphoreCount] = warpReloadSemaphore;
+            waitStages[submitInfo.waitSemaphoreCount++] = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            waitForWarpReload = false;
+        }
         submitInfo.pWaitSemaphores = waitSemaphores;
         submitInfo.pWaitDstStageMask = waitStages;
 
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffers[imgIndex];
+        submitInfo.commandBufferCount = uploadRecorded ? 2 : 1;
+        submitInfo.pCommandBuffers = uploadRecorded ? submitCommandBuffers : &commandBuffers[currentFrame];
 
         VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.signalSemaphoreCount = options.headless ? 0 : 1; // nothing is presented headless
         submitInfo.pSignalSemaphores = signalSemaphores;
 
         vkResetFences(logicalDevice, 1, &inFlightFences[currentFrame]);
 
         res = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]);
-        if (res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR || framebufferResized) {
-            framebufferResized = false;
-            recreateSwapChain();
-        } else if (res != VK_SUCCESS) {
+        if (res != VK_SUCCESS) {
             throw std::runtime_error("failed to submit draw command buffer!");
         }
+        frameSubmissions[currentFrame] = ++submittedFrames;
+
+        if (options.headless) {
+            currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+            return;
+        }
 
         VkPresentInfoKHR presentInfo = {};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1645,18 +5718,29 @@ private:
         presentInfo.pImageIndices = &imgIndex;
         //presentInfo.pResults = nullptr; // pointer to array of results to match (useful with multiple swap chains)
 
-        vkQueuePresentKHR(presentQueue, &presentInfo);
+        // recreated after presenting, so that this frame still goes to the image it was drawn into
+        res = vkQueuePresentKHR(presentQueue, &presentInfo);
+        if (res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR || framebufferResized) {
+            framebufferResized = false;
+            recreateSwapChain();
+        } else if (res != VK_SUCCESS) {
+            throw std::runtime_error("failed to present swap chain image!");
+        }
 
-        vkQueueWaitIdle(presentQueue);
+        if (!firstFramePresented) {
+            firstFramePresented = true;
+            auto startupMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - runStartTime).count();
+            std::cout << "time to first frame: " << startupMicros / 1000.0 << " ms" << std::endl;
+        }
 
         currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
     }
 
-    VkShaderModule createShaderModule(const std::vector<char>& code) {
+    VkShaderModule createShaderModule(const std::vector<uint32_t>& code) {
         VkShaderModuleCreateInfo smCreateInfo = {};
         smCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        smCreateInfo.codeSize = code.size();
-        smCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+        smCreateInfo.codeSize = code.size() * sizeof(uint32_t);
+        smCreateInfo.pCode = code.data();
 
         VkShaderModule shaderModule;
         VkResult res = vkCreateShaderModule(logicalDevice, &smCreateInfo, nullptr, &shaderModule);
@@ -1745,6 +5829,10 @@ private:
         /*if (indices.isComplete()) {
             std::cout << "all required queue families found" << std::endl;
         }*/
+        if (options.headless) {
+            // neither swap chain nor anisotropic filtering, any device with a graphics queue will do (e.g. lavapipe)
+            return indices.isComplete();
+        }
         
         bool extensionSupported = checkDeviceExtensionSupport(device);
 
@@ -1778,6 +5866,42 @@ private:
         return requiredExtensions.empty();
     }
 
+    // Host memory import needs the instance extensions, both device extensions and a shared-memory alignment compatible with the device
+    bool checkHostMemoryImportSupport(VkPhysicalDevice device) {
+        if (!hostMemoryImportInstanceExtensions) {
+            return false;
+        }
+
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        std::set<std::string> requiredExtensions = {VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME};
+        for (const auto& extension : availableExtensions) {
+            requiredExtensions.erase(extension.extensionName);
+        }
+        if (!requiredExtensions.empty()) {
+            return false;
+        }
+
+        auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+        if (getProperties2 == nullptr) {
+            return false;
+        }
+
+        VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+        hostProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties = {};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &hostProperties;
+        getProperties2(device, &properties);
+
+        hostPointerAlignment = hostProperties.minImportedHostPointerAlignment;
+        return hostPointerAlignment > 0 && CAPTURE_SHM_ALIGNMENT % hostPointerAlignment == 0;
+    }
+
     QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
         QueueFamilyIndices indices;
         uint32_t queueFamilyCount = 0;
@@ -1793,7 +5917,11 @@ private:
             }
 
             VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            if (options.headless) {
+                presentSupport = indices.graphicsFamily.has_value(); // no surface: the graphics queue stands in for the present one
+            } else {
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+            }
 
             if (queueFamily.queueCount > 0 && presentSupport) {
                 indices.presentFamily = i;
@@ -1807,9 +5935,35 @@ private:
             i++;
         }
 
+        // a family with transfer but without graphics support is usually backed by a dedicated copy engine
+        for (uint32_t j = 0; j < queueFamilyCount; j++) {
+            VkQueueFlags flags = queueFamilies[j].queueFlags;
+            if (queueFamilies[j].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+                // prefer transfer-only families over async compute ones
+                if (!indices.transferFamily.has_value() || !(flags & VK_QUEUE_COMPUTE_BIT)) {
+                    indices.transferFamily = j;
+                }
+            }
+        }
+
         return indices;
     }
 
+    bool checkInstanceExtensionSupport(const char* extensionName) {
+        uint32_t extensionCount;
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+
+        for (const auto& extension : availableExtensions) {
+            if (strcmp(extensionName, extension.extensionName) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     bool checkValidationLayerSupport() {
         uint32_t layerCount;
         vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
@@ -1835,16 +5989,26 @@ private:
     }
 
     std::vector<const char*> getRequiredExtensions() {
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-        std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        std::vector<const char*> extensions;
+        if (!options.headless) {
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
 
         if (enableValidationLayers) {
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
             extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
         }
+        // on a Vulkan 1.0 instance, querying minImportedHostPointerAlignment and enabling VK_KHR_external_memory
+        // on the device need these instance extensions (core since 1.1)
+        if (capture && options.importHostMemory && checkInstanceExtensionSupport(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)
+                && checkInstanceExtensionSupport(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME)) {
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
+            hostMemoryImportInstanceExtensions = true;
+        }
         return extensions;
     }
 
@@ -1873,39 +6037,191 @@ private:
     }
 
 public:
-    void run(bool argCapture, const char* uvMSFilename, const char* uvLSFilename, bool fullscreen){
+    void run(bool argCapture, const char* uvMSFilename, const char* uvLSFilename, bool fullscreen, const VkWarpOptions& argOptions){
         capture = argCapture;
-        initWindow();
-        initVulkan(fullscreen, uvMSFilename, uvLSFilename);
+        options = argOptions;
+        if (options.damageTracking && (options.warpMode == WARP_MODE_NONE || options.warpMode == WARP_MODE_TEXCOORD)) {
+            // the tile dependency index follows the warp map, which these modes do not use
+            std::cout << "damage tracking disabled, the warp mode does not read the warp map" << std::endl;
+            options.damageTracking = false;
+        }
+        if (options.meshWarp && (options.nearestWarp || (options.warpMode != WARP_MODE_16BIT && options.warpMode != WARP_MODE_8BIT))) {
+            // the mesh follows the filtered warp map, which these modes do not read
+            std::cout << "mesh warp disabled, the warp mode does not read the filtered warp map" << std::endl;
+            options.meshWarp = false;
+        }
+        if (!options.writeWarpMapFile.empty()) {
+            convertWarpMap(uvMSFilename, uvLSFilename);
+            return;
+        }
+        if (!options.batchInput.empty()) {
+            batchFrames = listImageFiles(options.batchInput);
+            if (batchFrames.empty()) {
+                throw std::runtime_error("no batch frames found in " + options.batchInput + "!");
+            }
+            std::cout << batchFrames.size() << " batch frames" << std::endl;
+            options.headless = true;
+            options.colorImageFile = batchFrames[0]; // sizes the color textures, every frame must match it
+            options.damageTracking = false; // each frame is a new image
+            options.batchDepth = std::max<uint32_t>(options.batchDepth, MAX_FRAMES_IN_FLIGHT + 1);
+        }
+        if (options.cpuWarp) {
+            if (capture || !options.batchInput.empty()) {
+                throw std::runtime_error("the CPU warp only renders the color image, not captures or batches!");
+            }
+            runCpuWarp(uvMSFilename, uvLSFilename, fullscreen);
+            return;
+        }
+        if (options.headless && capture) {
+            throw std::runtime_error("capture mode needs a display, it cannot run headless!");
+        }
+        if (!options.headless) {
+            initWindow();
+        }
+        runStartTime = std::chrono::steady_clock::now();
+        uvMSFile = uvMSFilename;
+        uvLSFile = uvLSFilename;
+        startImageDecodes(uvMSFilename, uvLSFilename);
+        initVulkan(fullscreen);
+        if (options.watchWarpMap) {
+            initWarpWatch();
+        }
         mainLoop();
         cleanup();
+        if (validationFailed) {
+            throw std::runtime_error("the output differs from the CPU warp beyond the validation limits!");
+        }
     }
 };
 
+#if __linux__
+bool VkWarpApp::shmAttachFailed = false;
+#endif
+
+void parseOption(const char* arg, VkWarpOptions& options) {
+    if (strcmp(arg, "--import-host-memory") == 0) {
+        options.importHostMemory = true;
+    } else if (strcmp(arg, "--no-transfer-queue") == 0) {
+        options.transferQueue = false;
+    } else if (strcmp(arg, "--no-damage-tracking") == 0) {
+        options.damageTracking = false;
+    } else if (strcmp(arg, "--float-warp-map") == 0) {
+        options.floatWarpMap = true;
+    } else if (strcmp(arg, "--warp-mode=16") == 0) {
+        options.warpMode = WARP_MODE_16BIT;
+    } else if (strcmp(arg, "--warp-mode=8") == 0) {
+        options.warpMode = WARP_MODE_8BIT;
+    } else if (strcmp(arg, "--warp-mode=none") == 0) {
+        options.warpMode = WARP_MODE_NONE;
+    } else if (strcmp(arg, "--warp-mode=texcoord") == 0) {
+        options.warpMode = WARP_MODE_TEXCOORD;
+    } else if (strcmp(arg, "--no-intensity") == 0) {
+        options.applyIntensity = false;
+    } else if (strcmp(arg, "--nearest-warp") == 0) {
+        options.nearestWarp = true;
+    } else if (strcmp(arg, "--mesh-warp") == 0) {
+        options.meshWarp = true;
+    } else if (strncmp(arg, "--mesh-warp=", 12) == 0) {
+        options.meshWarp = true;
+        options.meshWarpMaxError = std::stof(arg + 12);
+    } else if (strcmp(arg, "--no-coverage-mesh") == 0) {
+        options.coverageMesh = false;
+    } else if (strcmp(arg, "--no-pipeline-cache") == 0) {
+        options.pipelineCache = false;
+    } else if (strncmp(arg, "--spirv-dir=", 12) == 0) {
+        options.spirvDir = arg + 12;
+    } else if (strncmp(arg, "--warp-map=", 11) == 0) {
+        options.warpMapFile = arg + 11;
+    } else if (strncmp(arg, "--write-warp-map=", 17) == 0) {
+        options.writeWarpMapFile = arg + 17;
+    } else if (strcmp(arg, "--no-texture-cache") == 0) {
+        options.textureCache = false;
+    } else if (strncmp(arg, "--texture-cache=", 16) == 0) {
+        options.textureCacheDir = arg + 16;
+    } else if (strncmp(arg, "--texture-cache-size=", 21) == 0) {
+        options.textureCacheMaxBytes = std::stoull(arg + 21) << 20;
+    } else if (strcmp(arg, "--watch-warp-map") == 0) {
+        options.watchWarpMap = true;
+    } else if (strncmp(arg, "--color-image=", 14) == 0) {
+        options.colorImageFile = arg + 14;
+    } else if (strncmp(arg, "--batch=", 8) == 0) {
+        options.batchInput = arg + 8;
+    } else if (strncmp(arg, "--batch-output=", 15) == 0) {
+        options.batchOutputDir = arg + 15;
+    } else if (strncmp(arg, "--batch-depth=", 14) == 0) {
+        options.batchDepth = static_cast<uint32_t>(std::stoul(arg + 14));
+    } else if (strcmp(arg, "--cpu-warp") == 0) {
+        options.cpuWarp = true;
+    } else if (strcmp(arg, "--cpu-warp=scalar") == 0) {
+        options.cpuWarp = true;
+        options.cpuWarpIsa = CPU_WARP_SCALAR;
+    } else if (strcmp(arg, "--cpu-warp=sse4") == 0) {
+        options.cpuWarp = true;
+        options.cpuWarpIsa = CPU_WARP_SSE41;
+    } else if (strcmp(arg, "--cpu-warp=avx2") == 0) {
+        options.cpuWarp = true;
+        options.cpuWarpIsa = CPU_WARP_AVX2;
+    } else if (strcmp(arg, "--cpu-warp-benchmark") == 0) {
+        options.cpuWarp = true;
+        options.cpuWarpBenchmark = true;
+    } else if (strcmp(arg, "--validate") == 0) {
+        options.validate = true;
+        options.headless = true;
+    } else if (strcmp(arg, "--headless") == 0) {
+        options.headless = true;
+    } else if (strncmp(arg, "--frames=", 9) == 0) {
+        options.frames = static_cast<uint32_t>(std::max(1ul, std::stoul(arg + 9)));
+    } else if (strncmp(arg, "--output=", 9) == 0) {
+        options.outputFile = arg + 9;
+    } else if (strncmp(arg, "--output-size=", 14) == 0) {
+        unsigned int width = 0, height = 0;
+        if (sscanf(arg + 14, "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+            throw std::invalid_argument(std::string("invalid output size ") + (arg + 14));
+        }
+        options.outputWidth = width;
+        options.outputHeight = height;
+    } else {
+        throw std::invalid_argument(std::string("unknown option ") + arg);
+    }
+}
+
 int main(int argc, char const *argv[]){
     VkWarpApp vkBasicApp;
 
     try {
+        // "--flags" are stripped, the remaining positional arguments select the mode
+        VkWarpOptions options;
+        std::vector<const char*> args;
+        for (int i = 0; i < argc; i++) {
+            if (i > 0 && strncmp(argv[i], "--", 2) == 0) {
+                parseOption(argv[i], options);
+            } else {
+                args.push_back(argv[i]);
+            }
+        }
+        argc = static_cast<int>(args.size());
+        argv = args.data();
+
         char argCapture[] = "capture";
         char argFull[] = "full";
         //std::cout << argv[argc-1] << std::endl;
         if (strcmp(argCapture, argv[argc-1]) == 0) {
             std::cout << "captureID" << std::endl;
-            vkBasicApp.run(true, "textures/identityUVMS.png", "textures/identityUVLS.png", false);
+            vkBasicApp.run(true, "textures/identityUVMS.png", "textures/identityUVLS.png", false, options);
         } else if (argc > 4){
             std::cout << "captureWarp" << std::endl;
-            vkBasicApp.run(true, argv[2], argv[3], true);
+            vkBasicApp.run(true, argv[2], argv[3], true, options);
         } else if (argc > 2 && argc < 4) {
             if (strcmp(argFull, argv[argc-1])) {
                 std::cout << "runSimpleWarp" << std::endl;
-                vkBasicApp.run(false, argv[argc-2], argv[argc-1], true);
+                vkBasicApp.run(false, argv[argc-2], argv[argc-1], true, options);
             } else {
                 std::cout << "runSimpleWarp" << std::endl;
-                vkBasicApp.run(false, argv[argc-2], argv[argc-1], false);
+                vkBasicApp.run(false, argv[argc-2], argv[argc-1], false, options);
             }
         } else {
             std::cout << "Warp" << std::endl;
-            vkBasicApp.run(false, "textures/identityUVMS.png", "textures/identityUVLS.png", false);
+            vkBasicApp.run(false, "textures/identityUVMS.png", "textures/identityUVLS.png", false, options);
         }
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
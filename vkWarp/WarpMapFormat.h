@@ -0,0 +1,266 @@
+// Binary warp map container (.vwm), written by the UVTextures generators and memory-mapped by vkWarp.
+//
+// Layout: WarpMapHeader, then the texel data of every mip level (level 0 first) in two planes, starting at
+// levels[i].offset and levels[i].intensityOffset from the beginning of the data. The uv plane interleaves u, v in
+// the precision of the header, so it can be copied as-is into an R8G8_UNORM, R16G16_UNORM, R16G16_SFLOAT or
+// R32G32_SFLOAT image; the intensity plane is 8-bit unorm whatever the precision (an R8_UNORM image).
+#ifndef WARP_MAP_FORMAT_H
+#define WARP_MAP_FORMAT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "ContentHash.h"
+
+const uint32_t WARP_MAP_MAGIC = 0x504D5756; // "VWMP"
+const uint32_t WARP_MAP_VERSION = 3; // 2: 64-bit content hash as checksum, 3: uv and intensity planes
+const uint32_t WARP_MAP_MAX_LEVELS = 16;
+const uint32_t WARP_MAP_CHANNELS = 3; // u, v, intensity
+const uint64_t WARP_MAP_LEVEL_ALIGNMENT = 16; // of every plane
+
+enum WarpMapLayout : uint32_t {
+    WARP_MAP_LAYOUT_UV_INTENSITY = 2 // u, v plane, intensity plane (1 was u, v, intensity, 1 interleaved)
+};
+
+enum WarpMapPrecision : uint32_t {
+    WARP_MAP_UNORM8 = 1,
+    WARP_MAP_UNORM16 = 2,
+    WARP_MAP_FLOAT16 = 3,
+    WARP_MAP_FLOAT32 = 4
+};
+
+struct WarpMapLevel {
+    uint64_t offset; // of the uv plane, from the start of the data
+    uint64_t size;   // of the uv plane
+    uint32_t width;
+    uint32_t height;
+    uint64_t intensityOffset; // of the intensity plane (width * height bytes), from the start of the data
+};
+
+struct WarpMapHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t layout;    // WarpMapLayout
+    uint32_t channels;  // WARP_MAP_CHANNELS
+    uint32_t precision; // WarpMapPrecision
+    uint32_t levelCount;
+    uint64_t dataSize;
+    uint64_t checksum;  // contentHash (ContentHash.h) of the dataSize bytes following the header
+    WarpMapLevel levels[WARP_MAP_MAX_LEVELS];
+};
+
+// Bytes per texel of the uv plane (u and v), 0 for an unknown precision
+inline uint32_t warpMapTexelSize(uint32_t precision) {
+    switch (precision) {
+        case WARP_MAP_UNORM8: return 2 * 1;
+        case WARP_MAP_UNORM16: return 2 * 2;
+        case WARP_MAP_FLOAT16: return 2 * 2;
+        case WARP_MAP_FLOAT32: return 2 * 4;
+        default: return 0;
+    }
+}
+
+// Intensities are stored on 8 bits, the precision of the displayed colors they scale
+inline uint8_t warpMapIntensityFromUnorm16(uint16_t intensity) {
+    return static_cast<uint8_t>((intensity + 128) / 257);
+}
+
+// Levels of the full mip chain of a width x height map, down to 1x1 (level i is max(width >> i, 1) x max(height >> i, 1))
+inline uint32_t warpMapLevelCount(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    while ((width | height) >> levels) {
+        levels++;
+    }
+    return levels;
+}
+
+// IEEE 754 binary16 conversions (round to nearest even, the warp map values stay in [0, 1])
+inline uint16_t warpMapFloatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00); // overflow to infinity
+    }
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return static_cast<uint16_t>(sign); // underflow to zero
+        }
+        mantissa |= 0x800000; // denormal
+        uint32_t shift = static_cast<uint32_t>(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+    uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++; // may carry into the exponent, which is still the correctly rounded value
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+inline float warpMapHalfToFloat(uint16_t half) {
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // denormal: normalising the mantissa
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    } else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Reading u, v (uv plane texel) and intensity of one texel back as 16-bit values, whatever the precision of the file
+inline void warpMapTexelToUnorm16(const uint8_t* texel, uint8_t intensity, uint32_t precision, uint16_t* uvi) {
+    uvi[2] = static_cast<uint16_t>(intensity * 257);
+    for (uint32_t c = 0; c < 2; c++) {
+        float value;
+        switch (precision) {
+            case WARP_MAP_UNORM8:
+                uvi[c] = static_cast<uint16_t>(texel[c] * 257);
+                continue;
+            case WARP_MAP_UNORM16:
+                memcpy(&uvi[c], texel + 2 * c, sizeof(uint16_t));
+                continue;
+            case WARP_MAP_FLOAT16: {
+                uint16_t half;
+                memcpy(&half, texel + 2 * c, sizeof(uint16_t));
+                value = warpMapHalfToFloat(half);
+                break;
+            }
+            default:
+                memcpy(&value, texel + 4 * c, sizeof(float));
+                break;
+        }
+        uvi[c] = static_cast<uint16_t>(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f + 0.5f);
+    }
+}
+
+// Storing u, v (16-bit values) in the requested precision into the uv plane texel, and the intensity on 8 bits
+inline void warpMapTexelFromUnorm16(const uint16_t* uvi, uint32_t precision, uint8_t* texel, uint8_t* intensity) {
+    *intensity = warpMapIntensityFromUnorm16(uvi[2]);
+    for (uint32_t c = 0; c < 2; c++) {
+        uint16_t value = uvi[c];
+        switch (precision) {
+            case WARP_MAP_UNORM8:
+                texel[c] = static_cast<uint8_t>((value + 128) / 257);
+                break;
+            case WARP_MAP_UNORM16:
+                memcpy(texel + 2 * c, &value, sizeof(uint16_t));
+                break;
+            case WARP_MAP_FLOAT16: {
+                uint16_t half = warpMapFloatToHalf(value / 65535.0f);
+                memcpy(texel + 2 * c, &half, sizeof(uint16_t));
+                break;
+            }
+            default: {
+                float single = value / 65535.0f;
+                memcpy(texel + 4 * c, &single, sizeof(float));
+                break;
+            }
+        }
+    }
+}
+
+// Writing a .vwm file from a width x height map of 16-bit u, v, intensity triples. With mips the whole chain
+// down to 1x1 is precomputed with a 2x2 box filter (3 wide on the last row/column of odd sizes, so that no texel is dropped).
+// Returns false if the file cannot be written.
+inline bool writeWarpMap(const char* filename, uint32_t width, uint32_t height, const uint16_t* uvi, uint32_t precision, bool mips) {
+    uint32_t texelSize = warpMapTexelSize(precision);
+    if (texelSize == 0 || width == 0 || height == 0) {
+        return false;
+    }
+
+    WarpMapHeader header = {};
+    header.magic = WARP_MAP_MAGIC;
+    header.version = WARP_MAP_VERSION;
+    header.width = width;
+    header.height = height;
+    header.layout = WARP_MAP_LAYOUT_UV_INTENSITY;
+    header.channels = WARP_MAP_CHANNELS;
+    header.precision = precision;
+
+    std::vector<uint8_t> data;
+    std::vector<uint16_t> level(uvi, uvi + size_t(3) * width * height);
+    uint32_t levelWidth = width, levelHeight = height;
+    while (true) {
+        auto align = [](uint64_t offset) { return (offset + WARP_MAP_LEVEL_ALIGNMENT - 1) / WARP_MAP_LEVEL_ALIGNMENT * WARP_MAP_LEVEL_ALIGNMENT; };
+        WarpMapLevel& info = header.levels[header.levelCount++];
+        size_t texelCount = size_t(levelWidth) * levelHeight;
+        info.offset = align(data.size());
+        info.size = texelCount * texelSize;
+        info.width = levelWidth;
+        info.height = levelHeight;
+        info.intensityOffset = align(info.offset + info.size);
+        data.resize(info.intensityOffset + texelCount);
+        for (size_t i = 0; i < texelCount; i++) {
+            warpMapTexelFromUnorm16(&level[3 * i], precision, &data[info.offset + i * texelSize], &data[info.intensityOffset + i]);
+        }
+
+        if (!mips || (levelWidth == 1 && levelHeight == 1) || header.levelCount == WARP_MAP_MAX_LEVELS) {
+            break;
+        }
+        uint32_t nextWidth = std::max(levelWidth / 2, 1u), nextHeight = std::max(levelHeight / 2, 1u);
+        std::vector<uint16_t> next(size_t(3) * nextWidth * nextHeight);
+        for (uint32_t y = 0; y < nextHeight; y++) {
+            for (uint32_t x = 0; x < nextWidth; x++) {
+                // the last texel of a row/column also takes the one left over by an odd size
+                uint32_t x0 = std::min(2 * x, levelWidth - 1), x1 = x + 1 == nextWidth ? levelWidth - 1 : 2 * x + 1;
+                uint32_t y0 = std::min(2 * y, levelHeight - 1), y1 = y + 1 == nextHeight ? levelHeight - 1 : 2 * y + 1;
+                uint32_t count = (x1 - x0 + 1) * (y1 - y0 + 1);
+                for (uint32_t c = 0; c < 3; c++) {
+                    uint32_t sum = 0;
+                    for (uint32_t sy = y0; sy <= y1; sy++) {
+                        for (uint32_t sx = x0; sx <= x1; sx++) {
+                            sum += level[3 * (size_t(sy) * levelWidth + sx) + c];
+                        }
+                    }
+                    next[3 * (size_t(y) * nextWidth + x) + c] = static_cast<uint16_t>((sum + count / 2) / count);
+                }
+            }
+        }
+        level.swap(next);
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
+    header.dataSize = data.size();
+    header.checksum = contentHash(data.data(), data.size());
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data.data(), 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && written;
+}
+
+#endif
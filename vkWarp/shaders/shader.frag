@@ -1,31 +1,53 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 1) uniform sampler2D uvTexSamplerMS;
-layout(binding = 2) uniform sampler2D uvTexSamplerLS;
-layout(binding = 3) uniform sampler2D colorTexSampler;
+// Set by createGraphicsPipeline, every configuration is constant-folded into its own variant
+layout(constant_id = 0) const int WARP_MODE = 0; // 0 = 16-bits, 1 = 8-bits (MS byte only), 2 = non-layered, 3 = no texture mapping
+layout(constant_id = 1) const bool APPLY_INTENSITY = true; // scale by the intensity channel of the warp map
+layout(constant_id = 2) const bool NEAREST_WARP = false; // nearest warp texel instead of the filtered warp map
+layout(constant_id = 3) const bool MESH_WARP = false; // warp interpolated from the vertices of the fitted mesh
+
+layout(binding = 1) uniform sampler2D warpTexSampler; // u, v
+layout(binding = 2) uniform sampler2D colorTexSampler;
+layout(binding = 3) uniform sampler2D warpIntensitySampler; // intensity (R8), only read when it is applied
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragWarp;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    /** 16-bits layered texture mapping */
-    vec4 firstLayerTexCoordMS = texture(uvTexSamplerMS, fragTexCoord); // Most Significant 8-bits
-    vec4 firstLayerTexCoordLS = texture(uvTexSamplerLS, fragTexCoord); // Least Significant 8-bits
-    float u = (firstLayerTexCoordMS.r * 65280.0 + firstLayerTexCoordLS.r * 255.0) / 65535.0; // Computing 16-bits u coordinate
-    float v = (firstLayerTexCoordMS.g * 65280.0 + firstLayerTexCoordLS.g * 255.0) / 65535.0; // Computing 16-bits v coordinate
-    float intensity = (firstLayerTexCoordMS.b * 65280.0 + firstLayerTexCoordLS.b * 255.0) / 65535.0; // Computing 16-bits intensity
-    outColor = texture(colorTexSampler, vec2(u,v)) * intensity; // Computing final colour
-
-    /** 8-bits layered texture mapping */
-    //vec4 firstLayerTexCoord = texture(uvTexSamplerMS, fragTexCoord);
-    //outColor = texture(colorTexSampler, firstLayerTexCoord.rg) * firstLayerTexCoord.b;
+    /** no texture mapping */
+    if (WARP_MODE == 3) {
+        outColor = vec4(fragTexCoord, 0.0, 1.0);
+        return;
+    }
 
     /** non-layered texture mapping */
-    //outColor = texture(colorTexSampler, fragTexCoord);
+    if (WARP_MODE == 2) {
+        outColor = texture(colorTexSampler, fragTexCoord);
+        return;
+    }
 
-    /** no texture mapping */
-    //outColor = vec4(fragTexCoord, 0.0, 1.0);
-}
\ No newline at end of file
+    /** 16-bits texture mapping (MS/LS layers recombined at load, filtered as 16-bit values, intensity in its own 8-bit image) */
+    vec4 warp;
+    if (MESH_WARP) {
+        warp = vec4(fragWarp, 1.0); // the warp map is not sampled
+    } else if (NEAREST_WARP) {
+        ivec2 warpSize = textureSize(warpTexSampler, 0);
+        ivec2 texel = clamp(ivec2(fragTexCoord * vec2(warpSize)), ivec2(0), warpSize - 1);
+        warp = vec4(texelFetch(warpTexSampler, texel, 0).rg, APPLY_INTENSITY ? texelFetch(warpIntensitySampler, texel, 0).r : 1.0, 1.0);
+    } else {
+        warp = vec4(texture(warpTexSampler, fragTexCoord).rg, APPLY_INTENSITY ? texture(warpIntensitySampler, fragTexCoord).r : 1.0, 1.0);
+    }
+
+    vec2 uv = warp.rg;
+    /** 8-bits texture mapping (Most Significant 8-bits only) */
+    if (WARP_MODE == 1) {
+        uv = floor(uv * (65535.0 / 256.0)) / 255.0;
+    }
+
+    vec4 color = texture(colorTexSampler, uv);
+    outColor = APPLY_INTENSITY ? color * warp.b : color; // Computing final colour
+}
@@ -10,9 +10,11 @@ layout(binding = 0) uniform UniformBufferObject {
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+layout(location = 3) in vec3 inWarp; // u, v, intensity of the warp map at inTexCoord (mesh warp only)
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragWarp;
 
 out gl_PerVertex {
     vec4 gl_Position;
@@ -22,4 +24,5 @@ void main() {
     gl_Position = vec4(inPosition, 0.0, 1.0);
     fragColor = inColor;
     fragTexCoord = inTexCoord;
+    fragWarp = inWarp;
 }
\ No newline at end of file